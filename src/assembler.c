@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #define MAX_LINE_LENGTH 128
 #define MAX_FILE_NAME 256
@@ -17,9 +18,14 @@
 #define FNV_PRIME 1099511628211UL
 
 #define START_SYMBOL_ADDRESS 16U
+#define STACK_ADDRESS 256U
+#define HEAP_ADDRESS 2048U
 #define SCREEN_ADDRESS 16384U
 #define KEYBOARD_ADDRESS 24576U
 #define MAX_ADDRESS 32767U
+#define OBJECT_EXT ".o"
+#define RAM_MAP_EXT ".ram"
+#define SYMBOL_MAP_EXT ".map"
 
 #define EXIT_ERROR(t)                                                          \
   do {                                                                         \
@@ -28,10 +34,21 @@
     fclose(file);                                                              \
     free(path);                                                                \
     st_del(symbols);                                                           \
+    if (labels)                                                                \
+      st_del(labels);                                                          \
+    if (imports)                                                               \
+      st_del(imports);                                                         \
+    if (layout)                                                                \
+      layout_del(layout);                                                      \
+    if (lines)                                                                 \
+      lt_del(lines);                                                           \
     return EXIT_FAILURE;                                                       \
   } while (0)
 
+int link_objects(char const *path, char **objects, size_t n,
+                 bool debugInfo);
 extern char *realpath(const char *restrict path, char *restrict resolved_path);
+extern FILE *open_memstream(char **ptr, size_t *sizeloc);
 // hash-table {{{1
 // declarations {{{2
 typedef struct {
@@ -151,18 +168,452 @@ const char *st_set(SymbolTable *self, const char *key, unsigned value) {
   }
   return st_set_entry(self->entries, self->capacity, key, value, &self->length);
 }
+// static layout {{{1
+// declarations {{{2
+typedef struct {
+  const char *name;
+  unsigned uses;  // Instructions referring to the variable
+  unsigned order; // Position of its first use
+} Variable;
+typedef struct {
+  Variable *entries;
+  size_t length;
+  size_t capacity;
+  SymbolTable *index; // Index + 1 of every variable in entries
+} Layout;
+// layout_new {{{2
+Layout *layout_new(void) {
+  Layout *self = malloc(sizeof(Layout));
+  if (self == NULL) {
+    perror("Failed to allocate memory!");
+    return NULL;
+  }
+  self->length = 0;
+  self->capacity = INITIAL_CAPACITY;
+  self->entries = malloc(self->capacity * sizeof(Variable));
+  self->index = st_new();
+  if (self->entries == NULL || self->index == NULL) {
+    perror("Failed to allocate memory!");
+    free(self->entries);
+    if (self->index)
+      st_del(self->index);
+    free(self);
+    return NULL;
+  }
+  return self;
+}
+// layout_del {{{2
+void layout_del(Layout *self) {
+  // Names are owned by the index
+  st_del(self->index);
+  free(self->entries);
+  free(self);
+}
+// layout_add {{{2
+bool layout_add(Layout *self, const char *name, unsigned uses) {
+  unsigned i = st_get(self->index, name);
+  if (i) {
+    self->entries[i - 1].uses += uses;
+    return true;
+  }
+  if (self->length == self->capacity) {
+    Variable *grown =
+        realloc(self->entries, 2 * self->capacity * sizeof(Variable));
+    if (grown == NULL) {
+      perror("Failed to allocate memory!");
+      return false;
+    }
+    self->entries = grown;
+    self->capacity *= 2;
+  }
+  const char *key = st_set(self->index, name, self->length + 1);
+  if (key == NULL)
+    return false;
+  self->entries[self->length] =
+      (Variable){.name = key, .uses = uses, .order = self->length};
+  self->length++;
+  return true;
+}
+// layout_assign {{{2
+static int by_uses(const void *a, const void *b) {
+  const Variable *x = a, *y = b;
+  if (x->uses != y->uses)
+    return (x->uses < y->uses) ? 1 : -1;
+  return (x->order > y->order) - (x->order < y->order);
+}
+
+bool layout_assign(Layout *self, SymbolTable *symbols, unsigned bias,
+                   char const *map_path) {
+  /* Packs the variables from R16 up, the most used first, so the hot
+   * statics of a program always sit at the bottom of the static segment,
+   * and records the layout in a RAM map. Variables have to end below the
+   * stack, or the stack overwrites them. The address of every variable is
+   * stored in symbols, plus bias. */
+  qsort(self->entries, self->length, sizeof(Variable), by_uses);
+  FILE *map = fopen(map_path, "w");
+  if (map == NULL)
+    perror("Error creating RAM map");
+  else {
+    fprintf(map, "// %u-%u registers\n", 0U, START_SYMBOL_ADDRESS - 1);
+    fprintf(map, "// %u-%u static\n", START_SYMBOL_ADDRESS,
+            STACK_ADDRESS - 1);
+    fprintf(map, "// %u-%u stack\n", STACK_ADDRESS, HEAP_ADDRESS - 1);
+    fprintf(map, "// %u-%u heap\n", HEAP_ADDRESS, SCREEN_ADDRESS - 1);
+    fprintf(map, "// %u-%u screen\n", SCREEN_ADDRESS, KEYBOARD_ADDRESS - 1);
+    fprintf(map, "// %u keyboard\n", KEYBOARD_ADDRESS);
+    fprintf(map, "// address symbol uses\n");
+  }
+  unsigned address = START_SYMBOL_ADDRESS;
+  for (size_t i = 0; i < self->length; i++, address++) {
+    st_set(symbols, self->entries[i].name, address + bias);
+    if (map)
+      fprintf(map, "%u %s %u\n", address, self->entries[i].name,
+              self->entries[i].uses);
+  }
+  if (map)
+    fclose(map);
+  if (address > STACK_ADDRESS) {
+    fprintf(stderr,
+            "Error: %zu variables overflow the static segment into the "
+            "stack by %u words, see %s\n",
+            self->length, address - STACK_ADDRESS, map_path);
+    return false;
+  }
+  return true;
+}
+// line table {{{1
+// declarations {{{2
+typedef struct {
+  unsigned address;
+  char *text; // 'file:line function' as noted by the translator
+} SourceLine;
+typedef struct {
+  SourceLine *entries;
+  size_t length;
+  size_t capacity;
+} LineTable;
+// lt_new {{{2
+LineTable *lt_new(void) {
+  LineTable *self = malloc(sizeof(LineTable));
+  if (self == NULL) {
+    perror("Failed to allocate memory!");
+    return NULL;
+  }
+  self->length = 0;
+  self->capacity = INITIAL_CAPACITY;
+  self->entries = malloc(self->capacity * sizeof(SourceLine));
+  if (self->entries == NULL) {
+    perror("Failed to allocate memory!");
+    free(self);
+    return NULL;
+  }
+  return self;
+}
+// lt_del {{{2
+void lt_del(LineTable *self) {
+  for (size_t i = 0; i < self->length; i++)
+    free(self->entries[i].text);
+  free(self->entries);
+  free(self);
+}
+// lt_add {{{2
+bool lt_add(LineTable *self, unsigned address, const char *text) {
+  if (self->length == self->capacity) {
+    SourceLine *grown =
+        realloc(self->entries, 2 * self->capacity * sizeof(SourceLine));
+    if (grown == NULL) {
+      perror("Failed to allocate memory!");
+      return false;
+    }
+    self->entries = grown;
+    self->capacity *= 2;
+  }
+  char *copy = strndup(text, strcspn(text, "\r\n"));
+  if (copy == NULL) {
+    perror("Failed to allocate memory!");
+    return false;
+  }
+  self->entries[self->length++] = (SourceLine){address, copy};
+  return true;
+}
+// write_map {{{2
+static int by_address(const void *a, const void *b) {
+  const Symbol *x = a, *y = b;
+  return (x->value > y->value) - (x->value < y->value);
+}
+
+void write_map(char const *path, SymbolTable *labels, unsigned bias,
+               SymbolTable *variables, LineTable *lines) {
+  /* Writes every label and every noted source line with its ROM address,
+   * both sorted by address, so any address maps back to the function and
+   * the source line it came from */
+  Symbol *sorted = malloc(labels->length * sizeof(Symbol));
+  FILE *map = fopen(path, "w");
+  if (sorted == NULL || map == NULL) {
+    perror("Error writing symbol map");
+    free(sorted);
+    if (map)
+      fclose(map);
+    return;
+  }
+  size_t n = 0;
+  for (size_t i = 0; i < labels->capacity; i++) {
+    Symbol *s = &labels->entries[i];
+    if (s->key && !(variables && st_get(variables, s->key)))
+      sorted[n++] = (Symbol){s->key, s->value - bias};
+  }
+  qsort(sorted, n, sizeof(Symbol), by_address);
+  for (size_t i = 0; i < n; i++)
+    fprintf(map, "label %u %s\n", sorted[i].value, sorted[i].key);
+  for (size_t i = 0; i < lines->length; i++)
+    fprintf(map, "line %u %s\n", lines->entries[i].address,
+            lines->entries[i].text);
+  fclose(map);
+  free(sorted);
+}
+// linker {{{1
+// link_scan {{{2
+static bool link_scan(char const *object, unsigned base, unsigned *size,
+                      SymbolTable *globals, LineTable *lines) {
+  /* Records the exported labels of an object at their final address, and
+   * its source lines if asked for */
+  char line[MAX_LINE_LENGTH];
+  char name[MAX_LINE_LENGTH];
+  unsigned offset;
+  int length;
+  FILE *file = fopen(object, "r");
+  if (file == NULL) {
+    perror(object);
+    return false;
+  }
+  if (!fgets(line, sizeof(line), file) || sscanf(line, "code %u", size) != 1) {
+    fprintf(stderr, "%s: Invalid object\n", object);
+    fclose(file);
+    return false;
+  }
+  bool ok = true;
+  while (ok && fgets(line, sizeof(line), file)) {
+    if (sscanf(line, "export %127s %u", name, &offset) == 2) {
+      if (st_get(globals, name)) {
+        fprintf(stderr, "%s: Duplicate label %s\n", object, name);
+        ok = false;
+      }
+      st_set(globals, name, base + offset + 1);
+    } else if (sscanf(line, "line %u %n", &offset, &length) == 1) {
+      if (lines)
+        ok = lt_add(lines, base + offset, line + length);
+    } else if (strncmp(line, "import", 6))
+      break;
+  }
+  fclose(file);
+  return ok;
+}
+// link_uses {{{2
+static bool link_uses(char const *object, SymbolTable *globals,
+                      Layout *layout) {
+  // Counts the uses of every import of an object no object exports
+  char line[MAX_LINE_LENGTH];
+  char name[MAX_LINE_LENGTH];
+  char word[MAX_LINE_LENGTH];
+  char **names = NULL; // Every import, by index
+  unsigned *uses = NULL;
+  unsigned nNames = 0;
+  unsigned k;
+  char kind;
+  bool ok = true;
+  FILE *file = fopen(object, "r");
+  if (file == NULL) {
+    perror(object);
+    return false;
+  }
+  while (ok && fgets(line, sizeof(line), file)) {
+    if (sscanf(line, "import %u %127s", &k, name) == 2) {
+      if (k >= nNames) {
+        char **grownNames = realloc(names, (k + 1) * sizeof(char *));
+        if (grownNames)
+          names = grownNames;
+        unsigned *grownUses = realloc(uses, (k + 1) * sizeof(unsigned));
+        if (grownUses)
+          uses = grownUses;
+        if (grownNames == NULL || grownUses == NULL) {
+          perror("Failed to allocate memory!");
+          ok = false;
+          break;
+        }
+        for (; nNames <= k; nNames++) {
+          names[nNames] = NULL;
+          uses[nNames] = 0;
+        }
+      }
+      free(names[k]);
+      names[k] = strdup(name);
+    } else if (sscanf(line, "%127s %c %u", word, &kind, &k) == 3 &&
+               kind == 'I' && k < nNames) {
+      uses[k]++;
+    }
+  }
+  for (k = 0; k < nNames; k++) {
+    if (ok && names[k] && !st_get(globals, names[k]))
+      ok = layout_add(layout, names[k], uses[k]);
+    free(names[k]);
+  }
+  free(names);
+  free(uses);
+  fclose(file);
+  return ok;
+}
+// link_write {{{2
+static bool link_write(char const *object, unsigned base, SymbolTable *globals,
+                       FILE *output) {
+  /* Writes the code of an object, moving its own labels by its base and
+   * resolving its imports to labels and laid out variables */
+  char line[MAX_LINE_LENGTH];
+  char name[MAX_LINE_LENGTH];
+  char word[MAX_LINE_LENGTH];
+  unsigned *resolved = NULL; // Address of every import, by index
+  unsigned nResolved = 0;
+  unsigned k;
+  char kind;
+  bool ok = true;
+  FILE *file = fopen(object, "r");
+  if (file == NULL) {
+    perror(object);
+    return false;
+  }
+  while (ok && fgets(line, sizeof(line), file)) {
+    if (!strncmp(line, "code", 4) || !strncmp(line, "export", 6) ||
+        !strncmp(line, "line", 4))
+      continue;
+    if (sscanf(line, "import %u %127s", &k, name) == 2) {
+      if (k >= nResolved) {
+        unsigned *grown = realloc(resolved, (k + 1) * sizeof(unsigned));
+        if (grown == NULL) {
+          perror("Failed to allocate memory!");
+          ok = false;
+          break;
+        }
+        resolved = grown;
+        nResolved = k + 1;
+      }
+      resolved[k] = st_get(globals, name) - 1;
+      continue;
+    }
+    int fields = sscanf(line, "%127s %c %u", word, &kind, &k);
+    unsigned value = strtoul(word, NULL, 2);
+    if (fields == 2 && kind == 'R') {
+      value += base;
+    } else if (fields == 3 && kind == 'I' && k < nResolved) {
+      value |= resolved[k];
+    } else if (fields != 1) {
+      fprintf(stderr, "%s: Invalid object\n", object);
+      ok = false;
+      break;
+    }
+    fprintf(output, "%016b\n", value);
+  }
+  free(resolved);
+  fclose(file);
+  return ok;
+}
+// link_objects {{{2
+int link_objects(char const *path, char **objects, size_t n,
+                 bool debugInfo) {
+  /* Lays the objects out in the given order, so the first one holds the
+   * entry point, and writes them as a single .hack file. Imports no object
+   * exports are variables, laid out as for a single file. */
+  unsigned *bases = calloc(n + 1, sizeof(unsigned));
+  SymbolTable *globals = st_new(); // Address + 1 of labels and variables
+  Layout *layout = layout_new();
+  LineTable *lines = (debugInfo) ? lt_new() : NULL;
+  if (bases == NULL || globals == NULL || layout == NULL ||
+      (debugInfo && lines == NULL)) {
+    perror("Failed to allocate memory!");
+    free(bases);
+    if (globals)
+      st_del(globals);
+    if (layout)
+      layout_del(layout);
+    if (lines)
+      lt_del(lines);
+    return EXIT_FAILURE;
+  }
+
+  bool ok = true;
+  for (size_t i = 0; ok && i < n; i++) {
+    unsigned size = 0;
+    ok = link_scan(objects[i], bases[i], &size, globals, lines);
+    bases[i + 1] = bases[i] + size;
+    if (bases[i + 1] > MAX_ADDRESS + 1) {
+      fprintf(stderr, "%s: Instruction address limit reached\n", objects[i]);
+      ok = false;
+    }
+  }
+
+  for (size_t i = 0; ok && i < n; i++)
+    ok = link_uses(objects[i], globals, layout);
+  char map_path[PATH_MAX];
+  char const *dot = strrchr(path, '.');
+  int length = (dot && !strchr(dot, '/')) ? dot - path : (int)strlen(path);
+  if (ok) {
+    snprintf(map_path, sizeof(map_path), "%.*s%s", length, path, RAM_MAP_EXT);
+    ok = layout_assign(layout, globals, 1, map_path);
+  }
+  if (ok && lines) {
+    snprintf(map_path, sizeof(map_path), "%.*s%s", length, path,
+             SYMBOL_MAP_EXT);
+    write_map(map_path, globals, 1, layout->index, lines);
+  }
+
+  FILE *output = (ok) ? fopen(path, "w") : NULL;
+  if (ok && output == NULL) {
+    perror("Error creating output file");
+    ok = false;
+  }
+  for (size_t i = 0; ok && i < n; i++)
+    ok = link_write(objects[i], bases[i], globals, output);
+  if (output)
+    fclose(output);
+
+  free(bases);
+  st_del(globals);
+  layout_del(layout);
+  if (lines)
+    lt_del(lines);
+  return (ok) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
 // main {{{1
 int main(int argc, char *argv[]) {
   // handle input/output {{{2
-  if (argc < 2) {
-    fprintf(stderr, "Usage: %s <file>\n", argv[0]);
+  bool object = false;       // Write a relocatable object instead of .hack
+  bool debugInfo = false;    // Write a map of labels and source lines
+  char const *linked = NULL; // Link the given objects into this file
+  for (int opt; (opt = getopt(argc, argv, "cgo:")) != -1;) {
+    switch (opt) {
+    case 'g':
+      debugInfo = true;
+      break;
+    case 'c':
+      object = true;
+      break;
+    case 'o':
+      linked = optarg;
+      break;
+    default:
+      optind = argc;
+    }
+  }
+  if (linked && optind < argc && !object)
+    return link_objects(linked, argv + optind, argc - optind, debugInfo);
+  if (linked || optind != argc - 1) {
+    fprintf(stderr, "Usage: %s [-c] [-g] <file>\n", argv[0]);
+    fprintf(stderr, "       %s [-g] -o <file.hack> <object>...\n", argv[0]);
     return EXIT_FAILURE;
   }
 
   char *path = malloc(PATH_MAX);
   if (path == NULL)
     return EXIT_FAILURE;
-  realpath(argv[1], path);
+  realpath(argv[optind], path);
   char *dot = strrchr(path, '.');
   if (path == NULL || dot == NULL) {
     free(path);
@@ -175,8 +626,23 @@ int main(int argc, char *argv[]) {
     return EXIT_FAILURE;
   }
 
-  strcpy(dot, ".hack");
-  FILE *output = fopen(path, "w");
+  /* An object keeps labels relative to its first instruction and leaves
+   * every other symbol to the linker, so its code is buffered until the
+   * exported and imported symbols are known */
+  char *code = NULL;
+  size_t codeSize = 0;
+  SymbolTable *labels = NULL;  // Address + 1 of every label
+  SymbolTable *imports = NULL; // Index + 1 of every symbol left unresolved
+  Layout *layout = NULL;
+  LineTable *lines = NULL; // Source lines noted by the translator, for -g
+  unsigned nImports = 0;
+  FILE *output;
+  if (object) {
+    output = open_memstream(&code, &codeSize);
+  } else {
+    strcpy(dot, ".hack");
+    output = fopen(path, "w");
+  }
   if (output == NULL) {
     fclose(file);
     return EXIT_FAILURE;
@@ -187,6 +653,18 @@ int main(int argc, char *argv[]) {
     perror("Failed to allocate memory!");
     return EXIT_FAILURE;
   }
+  labels = st_new();
+  if (object)
+    imports = st_new();
+  else
+    layout = layout_new();
+  if (debugInfo)
+    lines = lt_new();
+  if (labels == NULL || (imports == NULL && layout == NULL) ||
+      (debugInfo && lines == NULL)) {
+    perror("Failed to allocate memory!");
+    return EXIT_FAILURE;
+  }
   st_set(symbols, "SP", 0);
   st_set(symbols, "LCL", 1);
   st_set(symbols, "ARG", 2);
@@ -265,6 +743,11 @@ int main(int argc, char *argv[]) {
     bool isLabel = false;
     bool isInstr = false;
 
+    char *note = line + strspn(line, " \t");
+    if (lines && !strncmp(note, "//@ ", 4) &&
+        !lt_add(lines, instrNumber, note + 4))
+      EXIT_ERROR("Failed to allocate memory");
+
     for (size_t i = 0; i < strlen(line); i++) {
       char c = line[i];
 
@@ -301,14 +784,41 @@ int main(int argc, char *argv[]) {
       if (instrNumber > MAX_ADDRESS) {
         EXIT_ERROR("Instruction address limit reached");
       }
-      st_set(symbols, symbol, instrNumber);
+      st_set(labels, symbol, instrNumber + 1);
     } else if (isInstr) {
       instrNumber++;
     }
   }
+  // layout pass {{{2
+  if (!object) {
+    rewind(file);
+    for (size_t lineNumber = 1; fgets(line, MAX_LINE_LENGTH, file);
+         lineNumber++) {
+      char *c = line + strspn(line, " \t");
+      if (*c++ != '@' || isdigit(*c))
+        continue;
+      c[strcspn(c, " \t\r\n/")] = '\0';
+      if (strcmp(c, "SP") && strcmp(c, "R0") && !st_get(symbols, c) &&
+          !st_get(labels, c) && !layout_add(layout, c, 1))
+        EXIT_ERROR("Failed to allocate memory");
+    }
+    char map_path[PATH_MAX];
+    snprintf(map_path, sizeof(map_path), "%.*s%s", (int)(dot - path), path,
+             RAM_MAP_EXT);
+    if (!layout_assign(layout, symbols, 0, map_path)) {
+      fclose(output);
+      fclose(file);
+      free(path);
+      st_del(symbols);
+      st_del(labels);
+      layout_del(layout);
+      if (lines)
+        lt_del(lines);
+      return EXIT_FAILURE;
+    }
+  }
   // second pass {{{2
   rewind(file);
-  unsigned nextAddress = START_SYMBOL_ADDRESS;
   for (size_t lineNumber = 1; fgets(line, MAX_LINE_LENGTH, file);
        lineNumber++) {
     char aInstr[MAX_LINE_LENGTH] = {0};
@@ -372,15 +882,21 @@ int main(int argc, char *argv[]) {
       } else {
         if (!strcmp(aInstr, "SP") || !strcmp(aInstr, "R0")) {
           addr = 0;
+        } else if ((addr = st_get(labels, aInstr))) {
+          if (object) {
+            fprintf(output, "%s%015b R\n", opcode, addr - 1);
+            continue;
+          }
+          addr--;
+        } else if (object && !st_get(symbols, aInstr)) {
+          unsigned k = st_get(imports, aInstr);
+          if (!k)
+            st_set(imports, aInstr, k = ++nImports);
+          fprintf(output, "%s%015b I %u\n", opcode, 0U, k - 1);
+          continue;
         } else {
+          // Predefined, or a variable placed by the layout pass
           addr = st_get(symbols, aInstr);
-          if (!addr) {
-            if (nextAddress >= SCREEN_ADDRESS) {
-              EXIT_ERROR("Instruction address limit reached");
-            }
-            addr = nextAddress++;
-            st_set(symbols, aInstr, addr);
-          }
         }
       }
       fprintf(output, "%s%015b\n", opcode, addr);
@@ -406,10 +922,55 @@ int main(int argc, char *argv[]) {
       fprintf(output, "%s%07b%03b%03b\n", opcode, comp_d, dest_d, jmp_d);
     }
   }
+  // write object {{{2
+  if (object) {
+    fclose(output);
+    strcpy(dot, OBJECT_EXT);
+    output = fopen(path, "w");
+    if (output == NULL) {
+      perror("Error creating object file");
+      free(code);
+      fclose(file);
+      free(path);
+      st_del(symbols);
+      st_del(labels);
+      st_del(imports);
+      if (lines)
+        lt_del(lines);
+      return EXIT_FAILURE;
+    }
+    fprintf(output, "code %u\n", instrNumber);
+    for (size_t i = 0; i < labels->capacity; i++)
+      if (labels->entries[i].key)
+        fprintf(output, "export %s %u\n", labels->entries[i].key,
+                labels->entries[i].value - 1);
+    // In order of first use, which breaks ties in the static layout
+    for (unsigned k = 1; k <= nImports; k++)
+      for (size_t i = 0; i < imports->capacity; i++)
+        if (imports->entries[i].key && imports->entries[i].value == k)
+          fprintf(output, "import %u %s\n", k - 1, imports->entries[i].key);
+    for (size_t i = 0; lines && i < lines->length; i++)
+      fprintf(output, "line %u %s\n", lines->entries[i].address,
+              lines->entries[i].text);
+    fwrite(code, 1, codeSize, output);
+    free(code);
+    st_del(imports);
+  } else {
+    layout_del(layout);
+    if (lines) {
+      char map_path[PATH_MAX];
+      snprintf(map_path, sizeof(map_path), "%.*s%s", (int)(dot - path), path,
+               SYMBOL_MAP_EXT);
+      write_map(map_path, labels, 1, NULL, lines);
+    }
+  }
+  if (lines)
+    lt_del(lines);
   // }}}2
   fclose(output);
   fclose(file);
   free(path);
   st_del(symbols);
+  st_del(labels);
   return EXIT_SUCCESS;
 }
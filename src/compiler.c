@@ -10,8 +10,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/inotify.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #define MAX_LINE_LENGTH 256
@@ -29,7 +31,10 @@
 #define STACK_ADDRESS 256UCLASS, METHOD, FUNCTION,
 
 extern char *realpath(const char *restrict path, char *restrict resolved_path);
+extern FILE *open_memstream(char **ptr, size_t *sizeloc);
 FILE *out;
+size_t nErrors = 0;
+bool debugInfo = false; // Note the source line of every statement, -g
 
 // tokenizer {{{1
 // definitions {{{2
@@ -290,6 +295,7 @@ TokenList *tokenize_file(FILE *file) {
               fprintf(stderr, "%zu:%zu Parsing error. Bad token '%s'\n",
                       lineNumber, i, token);
               errno = PARSING_ERROR;
+              nErrors++;
               break;
             }
             *token = '\0';
@@ -326,6 +332,7 @@ typedef enum {
   STATIC_,
   LOCAL_,
   ARGUMENT_,
+  SUBROUTINE_,
   sk_num,
 } SymbolKind;
 
@@ -334,6 +341,7 @@ char const *const symbol_kind[sk_num] = {
     [STATIC_] = "static",
     [LOCAL_] = "local",
     [ARGUMENT_] = "argument",
+    [SUBROUTINE_] = "subroutine",
 };
 
 typedef struct {
@@ -464,15 +472,21 @@ static bool st_expand(SymbolTable *self) {
   self->capacity = new_capacity;
   return true;
 }
-// st_set {{{2
-void st_set(SymbolTable *self, const char *name, const char *type,
-            SymbolKind kind) {
-  unsigned idx;
+// st_put {{{2
+void st_put(SymbolTable *self, const char *name, const char *type,
+            SymbolKind kind, unsigned idx) {
   if (self->length >= self->capacity / 2) {
     if (!st_expand(self)) {
       return;
     }
   }
+  st_set_entry(self->entries, self->capacity, name, type, kind, idx,
+               &self->length);
+}
+// st_set {{{2
+void st_set(SymbolTable *self, const char *name, const char *type,
+            SymbolKind kind) {
+  unsigned idx;
   switch (kind) {
   case FIELD_:
     idx = self->field_idx;
@@ -494,15 +508,605 @@ void st_set(SymbolTable *self, const char *name, const char *type,
     idx = 0;
   }
 
-  st_set_entry(self->entries, self->capacity, name, type, kind, idx,
-               &self->length);
+  st_put(self, name, type, kind, idx);
   return;
 }
+// index_class {{{2
+void index_class(SymbolTable *self, TokenList *tl) {
+  /* Records every subroutine of a class as 'Class.name' with its kind as the
+   * type and the number of declared parameters as the index */
+  char name[MAX_LINE_LENGTH * 2];
+  char const *cls = NULL;
+  size_t depth = 0;
+  for (Token *tok = tl->head; tok; tok = tok->next) {
+    if (tok->type == SYMBOL && tok->data.symbol == '{') {
+      depth++;
+    } else if (tok->type == SYMBOL && tok->data.symbol == '}') {
+      depth--;
+    } else if (!cls && tok->type == KEYWORD && tok->data.keyword == CLASS &&
+               tok->next && tok->next->type == IDENTIFIER) {
+      cls = tok->next->data.strVal;
+    } else if (cls && depth == 1 && tok->type == KEYWORD &&
+               (tok->data.keyword == CONSTRUCTOR ||
+                tok->data.keyword == FUNCTION ||
+                tok->data.keyword == METHOD)) {
+      Token *id = (tok->next) ? tok->next->next : NULL;
+      if (!id || id->type != IDENTIFIER || !id->next ||
+          id->next->type != SYMBOL || id->next->data.symbol != '(')
+        continue;
+      unsigned nParams = 0;
+      for (Token *p = id->next->next; p && p->type != SYMBOL; p = p->next) {
+        // type name (',' type name)*
+        nParams++;
+        p = p->next;
+        if (!p || !p->next || p->next->type != SYMBOL ||
+            p->next->data.symbol != ',')
+          break;
+        p = p->next;
+      }
+      snprintf(name, sizeof(name), "%s.%s", cls, id->data.strVal);
+      st_put(self, name, keywords[tok->data.keyword], SUBROUTINE_, nParams);
+    }
+  }
+}
+// cache {{{1
+// declarations {{{2
+#define CACHE_DIR ".n2t"
+#define CACHE_FILE "jack.cache"
+
+typedef struct {
+  char name[MAX_FILE_NAME];
+  uint64_t source;   // Hash of the .jack file
+  uint64_t vm;       // Hash of the .vm file compiled from it
+  SymbolTable *subs; // Subroutines of the class, as in classIndex
+} CacheEntry;
+typedef struct {
+  CacheEntry *entries;
+  size_t length;
+  uint64_t signature; // Hash of the subroutines of all classes
+} Cache;
+// file_hash {{{2
+uint64_t file_hash(char const *path) {
+  // Returns 0 for files that can't be read
+  int saved = errno;
+  FILE *file = fopen(path, "r");
+  errno = saved;
+  if (file == NULL)
+    return 0;
+  uint64_t hash = FNV_OFFSET;
+  for (int c; (c = fgetc(file)) != EOF;) {
+    hash ^= (uint64_t)(unsigned char)c;
+    hash *= FNV_PRIME;
+  }
+  fclose(file);
+  return hash;
+}
+// signature_hash {{{2
+uint64_t signature_hash(SymbolTable *subs) {
+  // Order independent hash of every signature in the table
+  char sig[MAX_LINE_LENGTH * 3];
+  uint64_t hash = 0;
+  for (size_t i = 0; i < subs->capacity; i++) {
+    Symbol *sub = &subs->entries[i];
+    if (sub->name) {
+      snprintf(sig, sizeof(sig), "%s %s %zu", sub->name, sub->type, sub->idx);
+      hash ^= st_hash(sig);
+    }
+  }
+  return hash;
+}
+// cache_new {{{2
+Cache *cache_new(size_t capacity) {
+  Cache *self = malloc(sizeof(Cache));
+  if (self == NULL) {
+    perror("Failed to allocate memory!");
+    return NULL;
+  }
+  self->length = 0;
+  self->signature = 0;
+  self->entries = calloc(capacity + 1, sizeof(CacheEntry));
+  if (self->entries == NULL) {
+    perror("Failed to allocate memory!");
+    free(self);
+    return NULL;
+  }
+  return self;
+}
+// cache_del {{{2
+void *cache_del(Cache *self) {
+  for (size_t i = 0; i < self->length; i++) {
+    if (self->entries[i].subs)
+      st_del(self->entries[i].subs);
+  }
+  free(self->entries);
+  free(self);
+  return NULL;
+}
+// cache_load {{{2
+Cache *cache_load(char const *path) {
+  /* class <file> <source hash> <vm hash>
+   * sub <Class.name> <kind> <parameters> */
+  char line[MAX_LINE_LENGTH * 3];
+  char name[MAX_LINE_LENGTH * 2];
+  char type[MAX_TOKEN_LENGTH];
+  unsigned long long source, vm;
+  unsigned nParams;
+  size_t capacity = 0;
+  int saved = errno;
+  FILE *file = fopen(path, "r");
+  errno = saved;
+  if (file == NULL)
+    return NULL;
+  while (fgets(line, sizeof(line), file)) {
+    if (!strncmp(line, "class ", 6))
+      capacity++;
+  }
+  rewind(file);
+  Cache *self = cache_new(capacity);
+  if (self == NULL) {
+    fclose(file);
+    return NULL;
+  }
+  if (fgets(line, sizeof(line), file) &&
+      sscanf(line, "signature %llx", &source) == 1)
+    self->signature = source;
+  CacheEntry *entry = NULL;
+  while (fgets(line, sizeof(line), file)) {
+    if (sscanf(line, "class %255s %llx %llx", name, &source, &vm) == 3 &&
+        self->length < capacity) {
+      entry = &self->entries[self->length++];
+      strcpy(entry->name, name);
+      entry->source = source;
+      entry->vm = vm;
+      entry->subs = st_new();
+    } else if (entry && entry->subs &&
+               sscanf(line, "sub %511s %31s %u", name, type, &nParams) == 3) {
+      st_put(entry->subs, name, type, SUBROUTINE_, nParams);
+    }
+  }
+  fclose(file);
+  return self;
+}
+// cache_find {{{2
+CacheEntry *cache_find(Cache *self, char const *name) {
+  for (size_t i = 0; i < self->length; i++) {
+    if (!strcmp(self->entries[i].name, name))
+      return &self->entries[i];
+  }
+  return NULL;
+}
+// cache_save {{{2
+void cache_save(Cache *self, char const *path) {
+  int saved = errno;
+  FILE *file = fopen(path, "w");
+  errno = saved;
+  if (file == NULL)
+    return;
+  fprintf(file, "signature %016llx\n", (unsigned long long)self->signature);
+  for (size_t i = 0; i < self->length; i++) {
+    CacheEntry *entry = &self->entries[i];
+    fprintf(file, "class %s %016llx %016llx\n", entry->name,
+            (unsigned long long)entry->source, (unsigned long long)entry->vm);
+    for (size_t j = 0; entry->subs && j < entry->subs->capacity; j++) {
+      Symbol *sub = &entry->subs->entries[j];
+      if (sub->name)
+        fprintf(file, "sub %s %s %zu\n", sub->name, sub->type, sub->idx);
+    }
+  }
+  fclose(file);
+}
+// cache_forget {{{2
+void cache_forget(char const *dir, char const *fname) {
+  /* Drops a deleted class from the cache of its directory, and the .vm file
+   * compiled from it unless it was edited since. The signature is kept, so
+   * the next run compiles its callers again. */
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s%c%s%c%s", dir, SLASH, CACHE_DIR, SLASH,
+           CACHE_FILE);
+  Cache *cache = cache_load(path);
+  if (cache == NULL)
+    return;
+  CacheEntry *entry = cache_find(cache, fname);
+  if (entry) {
+    char vm_path[PATH_MAX];
+    snprintf(vm_path, sizeof(vm_path), "%s%c%s", dir, SLASH, fname);
+    char *dot = strrchr(vm_path, '.');
+    if (dot && (size_t)(dot - vm_path) + 4 < sizeof(vm_path)) {
+      strcpy(dot, ".vm");
+      int saved = errno;
+      if (entry->vm && file_hash(vm_path) == entry->vm)
+        unlink(vm_path);
+      errno = saved;
+    }
+    if (entry->subs)
+      st_del(entry->subs);
+    *entry = cache->entries[--cache->length];
+    cache_save(cache, path);
+  }
+  cache_del(cache);
+}
+// optimizer {{{1
+// declarations {{{2
+#define MAX_LOCALS 64
+
+typedef struct {
+  char *text;
+  char cmd[MAX_TOKEN_LENGTH];
+  char arg1[MAX_LINE_LENGTH];
+  int arg2;
+  bool dead;
+  bool note; // Comment kept in place, dead to every pass
+} VMLine;
+typedef struct {
+  VMLine *lines;
+  size_t length;
+  size_t capacity;
+} VMCode;
+// vm_parse {{{2
+VMCode *vm_parse(char *buf) {
+  VMCode *self = malloc(sizeof(VMCode));
+  if (self == NULL) {
+    perror("Failed to allocate memory!");
+    return NULL;
+  }
+  self->length = 0;
+  self->capacity = INITIAL_CAPACITY;
+  self->lines = malloc(self->capacity * sizeof(VMLine));
+  if (self->lines == NULL) {
+    perror("Failed to allocate memory!");
+    free(self);
+    return NULL;
+  }
+  for (char *line = strtok(buf, "\n"); line; line = strtok(NULL, "\n")) {
+    if (self->length >= self->capacity) {
+      VMLine *lines =
+          realloc(self->lines, self->capacity * 2 * sizeof(VMLine));
+      if (lines == NULL) {
+        perror("Failed to allocate memory!");
+        break;
+      }
+      self->lines = lines;
+      self->capacity *= 2;
+    }
+    VMLine *l = &self->lines[self->length++];
+    l->text = line;
+    l->cmd[0] = '\0';
+    l->arg1[0] = '\0';
+    l->arg2 = -1;
+    l->note = !strncmp(line, "//", 2);
+    l->dead = l->note;
+    sscanf(line, "%31s %255s %d", l->cmd, l->arg1, &l->arg2);
+  }
+  return self;
+}
+// vm_del {{{2
+void *vm_del(VMCode *self) {
+  free(self->lines);
+  free(self);
+  return NULL;
+}
+// vm_write {{{2
+void vm_write(VMCode *self, FILE *output) {
+  for (size_t i = 0; i < self->length; i++) {
+    if (!self->lines[i].dead || self->lines[i].note)
+      fprintf(output, "%s\n", self->lines[i].text);
+  }
+}
+// aux functions {{{2
+bool is_branch(VMLine const *l) {
+  return !strcmp(l->cmd, "goto") || !strcmp(l->cmd, "if-goto");
+}
+
+bool ends_block(VMLine const *l) {
+  return is_branch(l) || !strcmp(l->cmd, "return");
+}
+
+bool is_local(VMLine const *l, char const *cmd) {
+  return !strcmp(l->cmd, cmd) && !strcmp(l->arg1, "local") && l->arg2 >= 0 &&
+         l->arg2 < MAX_LOCALS;
+}
+
+size_t find_label(VMCode *self, char const *label) {
+  for (size_t i = 0; i < self->length; i++) {
+    if (!self->lines[i].dead && !strcmp(self->lines[i].cmd, "label") &&
+        !strcmp(self->lines[i].arg1, label))
+      return i;
+  }
+  return self->length;
+}
+
+bool is_referenced(VMCode *self, char const *label) {
+  for (size_t i = 0; i < self->length; i++) {
+    if (!self->lines[i].dead && is_branch(&self->lines[i]) &&
+        !strcmp(self->lines[i].arg1, label))
+      return true;
+  }
+  return false;
+}
+
+int stack_effect(VMLine const *l, int *pops) {
+  /* Returns the number of values pushed by a side-effect free command and
+   * stores the number it pops, or returns -1 for anything else. Writing
+   * pointer 1 counts as free since THAT is reloaded by every statement. */
+  if (!strcmp(l->cmd, "push")) {
+    *pops = 0;
+    return 1;
+  }
+  if (!strcmp(l->cmd, "pop") && !strcmp(l->arg1, "pointer") && l->arg2 == 1) {
+    *pops = 1;
+    return 0;
+  }
+  if (!strcmp(l->cmd, "neg") || !strcmp(l->cmd, "not")) {
+    *pops = 1;
+    return 1;
+  }
+  if (!strcmp(l->cmd, "add") || !strcmp(l->cmd, "sub") ||
+      !strcmp(l->cmd, "and") || !strcmp(l->cmd, "or") ||
+      !strcmp(l->cmd, "eq") || !strcmp(l->cmd, "gt") || !strcmp(l->cmd, "lt")) {
+    *pops = 2;
+    return 1;
+  }
+  return -1;
+}
+// opt_unreachable {{{2
+bool opt_unreachable(VMCode *self) {
+  /* Drops labels nothing jumps to, jumps to the very next label and the
+   * commands that follow a goto or a return up to the next live label */
+  bool changed = false;
+  bool reachable = true;
+  for (size_t i = 0; i < self->length; i++) {
+    VMLine *l = &self->lines[i];
+    if (l->dead)
+      continue;
+    if (!strcmp(l->cmd, "label")) {
+      if (is_referenced(self, l->arg1)) {
+        reachable = true;
+      } else {
+        l->dead = true;
+        changed = true;
+      }
+    } else if (!reachable) {
+      l->dead = true;
+      changed = true;
+    } else if (!strcmp(l->cmd, "goto") || !strcmp(l->cmd, "return")) {
+      reachable = false;
+    }
+  }
+  for (size_t i = 0; i < self->length; i++) {
+    VMLine *l = &self->lines[i];
+    if (l->dead || strcmp(l->cmd, "goto"))
+      continue;
+    size_t j = i + 1;
+    while (j < self->length && self->lines[j].dead)
+      j++;
+    if (j < self->length && !strcmp(self->lines[j].cmd, "label") &&
+        !strcmp(self->lines[j].arg1, l->arg1)) {
+      l->dead = true;
+      changed = true;
+    }
+  }
+  return changed;
+}
+// vm_blocks {{{2
+size_t vm_blocks(VMCode *self, size_t *block, size_t *start) {
+  /* Splits the live commands into basic blocks. Stores the block of every
+   * live command and the first command of every block, returns the count. */
+  size_t nBlocks = 0;
+  bool newBlock = true;
+  for (size_t i = 0; i < self->length; i++) {
+    VMLine *l = &self->lines[i];
+    if (l->dead)
+      continue;
+    if (!strcmp(l->cmd, "label"))
+      newBlock = true;
+    if (newBlock) {
+      start[nBlocks++] = i;
+      newBlock = false;
+    }
+    block[i] = nBlocks - 1;
+    if (ends_block(l))
+      newBlock = true;
+  }
+  start[nBlocks] = self->length;
+  return nBlocks;
+}
+// vm_successors {{{2
+size_t vm_successors(VMCode *self, size_t const *block, size_t const *start,
+                     size_t nBlocks, size_t b, size_t *succ) {
+  // Stores up to two blocks control can flow to from block b
+  size_t n = 0;
+  VMLine *last = NULL;
+  for (size_t i = start[b]; i < start[b + 1]; i++) {
+    if (!self->lines[i].dead)
+      last = &self->lines[i];
+  }
+  if (last == NULL)
+    return 0;
+  if (strcmp(last->cmd, "goto") && strcmp(last->cmd, "return") &&
+      b + 1 < nBlocks)
+    succ[n++] = b + 1;
+  if (is_branch(last)) {
+    size_t target = find_label(self, last->arg1);
+    if (target < self->length)
+      succ[n++] = block[target];
+  }
+  return n;
+}
+// opt_dead_stores {{{2
+bool opt_dead_stores(VMCode *self) {
+  /* Backward liveness of the local segment over the basic blocks of the
+   * function. A store to a local that is not live afterwards is removed
+   * together with the side-effect free commands computing its value. */
+  size_t n = self->length;
+  size_t *block = malloc(n * sizeof(size_t));
+  size_t *start = malloc((n + 1) * sizeof(size_t));
+  uint64_t *liveIn = calloc(n + 1, sizeof(uint64_t));
+  if (block == NULL || start == NULL || liveIn == NULL) {
+    perror("Failed to allocate memory!");
+    free(block);
+    free(start);
+    free(liveIn);
+    return false;
+  }
+  size_t nBlocks = vm_blocks(self, block, start);
+  size_t succ[2];
+
+  // Iterate the block equations until nothing changes
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (size_t b = nBlocks; b-- > 0;) {
+      uint64_t live = 0;
+      for (size_t s = vm_successors(self, block, start, nBlocks, b, succ);
+           s-- > 0;)
+        live |= liveIn[succ[s]];
+      for (size_t i = start[b + 1]; i-- > start[b];) {
+        VMLine *l = &self->lines[i];
+        if (l->dead)
+          continue;
+        if (is_local(l, "pop"))
+          live &= ~((uint64_t)1 << l->arg2);
+        else if (is_local(l, "push"))
+          live |= (uint64_t)1 << l->arg2;
+      }
+      if (live != liveIn[b]) {
+        liveIn[b] = live;
+        changed = true;
+      }
+    }
+  }
+
+  bool removed = false;
+  for (size_t b = 0; b < nBlocks; b++) {
+    uint64_t live = 0;
+    for (size_t s = vm_successors(self, block, start, nBlocks, b, succ);
+         s-- > 0;)
+      live |= liveIn[succ[s]];
+    for (size_t i = start[b + 1]; i-- > start[b];) {
+      VMLine *l = &self->lines[i];
+      if (l->dead)
+        continue;
+      if (is_local(l, "pop")) {
+        if (!(live & ((uint64_t)1 << l->arg2))) {
+          // Find the commands producing the stored value
+          int need = 1, pops;
+          size_t j = i;
+          while (need > 0 && j-- > start[b]) {
+            if (self->lines[j].dead)
+              continue;
+            int pushes = stack_effect(&self->lines[j], &pops);
+            if (pushes < 0 || pushes > need)
+              break;
+            need += pops - pushes;
+          }
+          if (!need) {
+            for (size_t k = j; k <= i; k++)
+              self->lines[k].dead = true;
+            removed = true;
+            continue;
+          }
+        }
+        live &= ~((uint64_t)1 << l->arg2);
+      } else if (is_local(l, "push")) {
+        live |= (uint64_t)1 << l->arg2;
+      }
+    }
+  }
+  free(block);
+  free(start);
+  free(liveIn);
+  return removed;
+}
+// uninitialized_locals {{{2
+uint64_t uninitialized_locals(VMCode *self) {
+  /* Forward must-assign analysis of the local segment. Returns the locals
+   * that may be read on some path before anything is stored to them, these
+   * are the only ones the function prologue needs to zero. */
+  size_t n = self->length;
+  size_t *block = malloc(n * sizeof(size_t));
+  size_t *start = malloc((n + 1) * sizeof(size_t));
+  uint64_t *in = malloc((n + 1) * sizeof(uint64_t));
+  uint64_t *assigned = malloc((n + 1) * sizeof(uint64_t));
+  if (block == NULL || start == NULL || in == NULL || assigned == NULL) {
+    perror("Failed to allocate memory!");
+    free(block);
+    free(start);
+    free(in);
+    free(assigned);
+    return ~(uint64_t)0;
+  }
+  size_t nBlocks = vm_blocks(self, block, start);
+  size_t succ[2];
+  for (size_t b = 0; b < nBlocks; b++)
+    assigned[b] = ~(uint64_t)0;
+
+  uint64_t uninit = 0;
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (size_t b = 0; b < nBlocks; b++)
+      in[b] = (b) ? ~(uint64_t)0 : 0;
+    for (size_t b = 0; b < nBlocks; b++) {
+      for (size_t s = vm_successors(self, block, start, nBlocks, b, succ);
+           s-- > 0;)
+        in[succ[s]] &= assigned[b];
+    }
+    uninit = 0;
+    for (size_t b = 0; b < nBlocks; b++) {
+      uint64_t done = in[b];
+      for (size_t i = start[b]; i < start[b + 1]; i++) {
+        VMLine *l = &self->lines[i];
+        if (l->dead)
+          continue;
+        if (is_local(l, "pop"))
+          done |= (uint64_t)1 << l->arg2;
+        else if (is_local(l, "push") && !(done & ((uint64_t)1 << l->arg2)))
+          uninit |= (uint64_t)1 << l->arg2;
+      }
+      if (done != assigned[b]) {
+        assigned[b] = done;
+        changed = true;
+      }
+    }
+  }
+  free(block);
+  free(start);
+  free(in);
+  free(assigned);
+  return uninit;
+}
+// optimize_function {{{2
+void optimize_function(char *buf, FILE *output) {
+  VMCode *code = vm_parse(buf);
+  if (code == NULL) {
+    fputs(buf, output);
+    return;
+  }
+  while (opt_unreachable(code) | opt_dead_stores(code))
+    ;
+  // Tell the translator which locals have to start out as zero
+  VMLine *function = code->lines;
+  if (code->length && !strcmp(function->cmd, "function") &&
+      function->arg2 > 0) {
+    uint64_t uninit = uninitialized_locals(code);
+    fprintf(output, "%s // zero", function->text);
+    for (int i = 0; i < function->arg2; i++) {
+      if (i >= MAX_LOCALS || (uninit & ((uint64_t)1 << i)))
+        fprintf(output, " %d", i);
+    }
+    fprintf(output, "\n");
+    function->dead = true;
+  }
+  vm_write(code, output);
+  code = vm_del(code);
+}
 // compilation engine {{{1
 // declarations {{{2
 int compExpressionList();
 void compTerm();
+void compArrayBase(Symbol *symbol);
+Token *pureIndex(Token *tok);
+void compOps();
 int compExpression();
+void compCondition(size_t i, size_t k);
 void compReturn();
 void compWhile();
 void compIf();
@@ -518,9 +1122,12 @@ void compClass();
 char className[MAX_LINE_LENGTH];
 SymbolTable *cst;
 SymbolTable *sst;
+SymbolTable *classIndex; // Subroutines of every class being compiled
+Keyword subKind;         // Kind of the subroutine being compiled
 Token *t;
 size_t gotoDepth = 0;
 size_t gotoInc = 0;
+Symbol *thatBase = NULL; // Array variable currently held in pointer 1
 // compExpressionList {{{2
 int compExpressionList() {
   // (expression (',' expression)* )?
@@ -536,10 +1143,56 @@ int compExpressionList() {
   if (errno) {
     fprintf(stderr, "[%zu:%zu] Syntax error: invalid expression list\n",
             t->lineN, t->lineP);
+    nErrors++;
     errno = 0;
   }
   return nArgs;
 }
+// compArrayBase {{{2
+void compArrayBase(Symbol *symbol) {
+  // Point THAT to the array unless it already points there
+  if (thatBase != symbol) {
+    fprintf(out, "\tpush %s %zu\n",
+            (symbol->kind == FIELD_) ? "this" : symbol_kind[symbol->kind],
+            symbol->idx);
+    fprintf(out, "\tpop pointer 1\n");
+    thatBase = symbol;
+  }
+}
+// pureIndex {{{2
+Token *pureIndex(Token *tok) {
+  /* Returns the closing ']' if the index expression starting at tok reads
+   * only constants, locals and arguments, so it can be evaluated after the
+   * right-hand side of an assignment. Returns NULL otherwise. */
+  Symbol *symbol;
+  size_t depth = 0;
+  for (; tok; tok = tok->next) {
+    if (tok->type == SYMBOL) {
+      if (tok->data.symbol == '(') {
+        depth++;
+      } else if (tok->data.symbol == ')') {
+        if (!depth)
+          return NULL;
+        depth--;
+      } else if (tok->data.symbol == ']') {
+        return (depth) ? NULL : tok;
+      } else if (tok->data.symbol == '[' || tok->data.symbol == '.' ||
+                 tok->data.symbol == ';' || tok->data.symbol == '*' ||
+                 tok->data.symbol == '/')
+        return NULL;
+    } else if (tok->type == IDENTIFIER) {
+      symbol = st_get(sst, tok->data.strVal);
+      if (!symbol || (symbol->kind != LOCAL_ && symbol->kind != ARGUMENT_) ||
+          (tok->next->type == SYMBOL &&
+           (tok->next->data.symbol == '[' || tok->next->data.symbol == '(' ||
+            tok->next->data.symbol == '.')))
+        return NULL;
+    } else if (tok->type == STR_CONST) {
+      return NULL;
+    }
+  }
+  return NULL;
+}
 // compTerm {{{2
 void compTerm() {
   /*   integerConstant | stringConstant | keywordConstant |
@@ -560,6 +1213,7 @@ void compTerm() {
       fprintf(out, "\tpush constant %d\n", t->data.strVal[i]);
       fprintf(out, "\tcall String.appendChar 2\n");
     }
+    thatBase = NULL;
     t = t->next;
 
   } else if (t->type == KEYWORD && t->data.keyword == TRUE) {
@@ -590,14 +1244,27 @@ void compTerm() {
         if (t->type == SYMBOL && t->data.symbol == '[') {
           t = t->next;
 
-          compExpression();
+          if (t->type == INT_CONST && t->next->type == SYMBOL &&
+              t->next->data.symbol == ']') {
+            // Constant index: address the element directly off THAT
+            compArrayBase(symbol);
+            fprintf(out, "\tpush that %d\n", t->data.intVal);
+            t = t->next;
 
-          if (t->type == SYMBOL && t->data.symbol == ']') {
-            fprintf(out, "\tpush %s %zu\n", symbol_kind[symbol->kind],
+          } else {
+            compExpression();
+
+            fprintf(out, "\tpush %s %zu\n",
+                    (symbol->kind == FIELD_) ? "this"
+                                             : symbol_kind[symbol->kind],
                     symbol->idx);
             fprintf(out, "\tadd\n");
             fprintf(out, "\tpop pointer 1\n");
             fprintf(out, "\tpush that 0\n");
+            thatBase = NULL;
+          }
+
+          if (t->type == SYMBOL && t->data.symbol == ']') {
             t = t->next;
 
           } else
@@ -652,13 +1319,61 @@ void compTerm() {
   if (errno) {
     fprintf(stderr, "[%zu:%zu] Syntax error: invalid term\n", t->lineN,
             t->lineP);
+    nErrors++;
     errno = 0;
   }
 }
+// compOps {{{2
+void compOps() {
+  // (op term)*
+  Token *op;
+  while (t->type == SYMBOL &&
+         (t->data.symbol == '+' || t->data.symbol == '-' ||
+          t->data.symbol == '*' || t->data.symbol == '/' ||
+          t->data.symbol == '&' || t->data.symbol == '|' ||
+          t->data.symbol == '<' || t->data.symbol == '>' ||
+          t->data.symbol == '=')) {
+    op = t;
+    t = t->next;
+
+    compTerm();
+
+    switch (op->data.symbol) {
+    case '+':
+      fprintf(out, "\tadd\n");
+      break;
+    case '-':
+      fprintf(out, "\tsub\n");
+      break;
+    case '*':
+      fprintf(out, "\tcall Math.multiply 2\n");
+      thatBase = NULL;
+      break;
+    case '/':
+      fprintf(out, "\tcall Math.divide 2\n");
+      thatBase = NULL;
+      break;
+    case '>':
+      fprintf(out, "\tgt\n");
+      break;
+    case '<':
+      fprintf(out, "\tlt\n");
+      break;
+    case '=':
+      fprintf(out, "\teq\n");
+      break;
+    case '&':
+      fprintf(out, "\tand\n");
+      break;
+    case '|':
+      fprintf(out, "\tor\n");
+      break;
+    }
+  }
+}
 // compExpression {{{2
 int compExpression() {
   // term (op term)*
-  Token *op;
   if ((t->type == INT_CONST) || (t->type == STR_CONST) ||
       ((t->type == KEYWORD &&
         (t->data.keyword == TRUE || t->data.keyword == FALSE ||
@@ -667,58 +1382,49 @@ int compExpression() {
       (t->type == SYMBOL && (t->data.symbol == '-' || t->data.symbol == '~'))) {
 
     compTerm();
-
-    while (t->type == SYMBOL &&
-           (t->data.symbol == '+' || t->data.symbol == '-' ||
-            t->data.symbol == '*' || t->data.symbol == '/' ||
-            t->data.symbol == '&' || t->data.symbol == '|' ||
-            t->data.symbol == '<' || t->data.symbol == '>' ||
-            t->data.symbol == '=')) {
-      op = t;
-      t = t->next;
-
-      compTerm();
-
-      switch (op->data.symbol) {
-      case '+':
-        fprintf(out, "\tadd\n");
-        break;
-      case '-':
-        fprintf(out, "\tsub\n");
-        break;
-      case '*':
-        fprintf(out, "\tcall Math.multiply 2\n");
-        break;
-      case '/':
-        fprintf(out, "\tcall Math.divide 2\n");
-        break;
-      case '>':
-        fprintf(out, "\tgt\n");
-        break;
-      case '<':
-        fprintf(out, "\tlt\n");
-        break;
-      case '=':
-        fprintf(out, "\teq\n");
-        break;
-      case '&':
-        fprintf(out, "\tand\n");
-        break;
-      case '|':
-        fprintf(out, "\tor\n");
-        break;
-      }
-    }
+    compOps();
     return 1;
   }
 
   if (errno) {
     fprintf(stderr, "[%zu:%zu] Syntax error: invalid expression\n", t->lineN,
             t->lineP);
+    nErrors++;
     errno = 0;
   }
   return 0;
 }
+// compCondition {{{2
+void compCondition(size_t i, size_t k) {
+  /* Emits a jump to label k of statement i taken when the expression is
+   * false. A leading '~' over the whole condition cancels against the
+   * negation of the branch, and a comparison left right before the branch is
+   * fused into a single conditional jump by the VM translator. */
+  if (t->type == KEYWORD && t->data.keyword == TRUE &&
+      t->next->type == SYMBOL && t->next->data.symbol == ')') {
+    t = t->next;
+
+  } else if (t->type == SYMBOL && t->data.symbol == '~') {
+    t = t->next;
+
+    compTerm();
+
+    if (t->type == SYMBOL && t->data.symbol == ')') {
+      fprintf(out, "\tif-goto %s_%zu_%zu_%zu\n", className, i, gotoDepth, k);
+    } else {
+      fprintf(out, "\tnot\n");
+      compOps();
+      fprintf(out, "\tnot\n\tif-goto %s_%zu_%zu_%zu\n", className, i,
+              gotoDepth, k);
+    }
+
+  } else {
+    compExpression();
+
+    fprintf(out, "\tnot\n\tif-goto %s_%zu_%zu_%zu\n", className, i, gotoDepth,
+            k);
+  }
+}
 // compReturn {{{2
 void compReturn() {
   // 'return' expression? ';'
@@ -752,6 +1458,7 @@ void compReturn() {
   if (errno) {
     fprintf(stderr, "[%zu:%zu] Syntax error: invalid return statement\n",
             t->lineN, t->lineP);
+    nErrors++;
     errno = 0;
   }
 }
@@ -764,9 +1471,7 @@ void compWhile() {
     fprintf(out, "label %s_%zu_%zu_0\n", className, i, gotoDepth);
     t = t->next;
 
-    compExpression();
-
-    fprintf(out, "\tnot\n\tif-goto %s_%zu_%zu_1\n", className, i, gotoDepth);
+    compCondition(i, 1);
 
     if (t->type == SYMBOL && t->data.symbol == ')') {
       t = t->next;
@@ -793,6 +1498,7 @@ void compWhile() {
   if (errno) {
     fprintf(stderr, "[%zu:%zu] Syntax error: invalid while statement\n",
             t->lineN, t->lineP);
+    nErrors++;
     errno = 0;
   }
 }
@@ -805,8 +1511,7 @@ void compIf() {
   if (t->type == SYMBOL && t->data.symbol == '(') {
     t = t->next;
 
-    compExpression();
-    fprintf(out, "\tnot\n\tif-goto %s_%zu_%zu_0\n", className, i, gotoDepth);
+    compCondition(i, 0);
 
     if (t->type == SYMBOL && t->data.symbol == ')') {
       t = t->next;
@@ -853,6 +1558,7 @@ void compIf() {
   if (errno) {
     fprintf(stderr, "[%zu:%zu] Syntax error: invalid if statement\n", t->lineN,
             t->lineP);
+    nErrors++;
     errno = 0;
   }
 }
@@ -861,6 +1567,9 @@ void compLet() {
   // 'let' varName ('[' expression ']')? '=' expression ';'
   Symbol *symbol;
   bool isArray = false;
+  int constIdx = -1;  // Constant index, stored with 'pop that constIdx'
+  Token *idx = NULL;  // Pure index, compiled after the right-hand side
+  Token *end = NULL;
   if (t->type == IDENTIFIER) {
     symbol = st_get(sst, t->data.strVal);
     if (!symbol)
@@ -872,10 +1581,23 @@ void compLet() {
         isArray = true;
         t = t->next;
 
-        compExpression();
+        if (t->type == INT_CONST && t->next->type == SYMBOL &&
+            t->next->data.symbol == ']') {
+          constIdx = t->data.intVal;
+          t = t->next;
 
-        fprintf(out, "\tpush %s %zu\n\tadd\n", symbol_kind[symbol->kind],
-                symbol->idx);
+        } else if ((end = pureIndex(t))) {
+          idx = t;
+          t = end;
+
+        } else {
+          compExpression();
+
+          fprintf(out, "\tpush %s %zu\n\tadd\n",
+                  (symbol->kind == FIELD_) ? "this" : symbol_kind[symbol->kind],
+                  symbol->idx);
+          thatBase = NULL;
+        }
 
         if (t->type == SYMBOL && t->data.symbol == ']') {
           t = t->next;
@@ -891,11 +1613,30 @@ void compLet() {
 
         if (t->type == SYMBOL && t->data.symbol == ';') {
 
-          if (isArray) {
+          if (constIdx >= 0) {
+            compArrayBase(symbol);
+            fprintf(out, "\tpop that %d\n", constIdx);
+
+          } else if (idx) {
+            end = t;
+            t = idx;
+            compExpression();
+            t = end;
+
+            fprintf(out, "\tpush %s %zu\n\tadd\n",
+                    (symbol->kind == FIELD_) ? "this"
+                                             : symbol_kind[symbol->kind],
+                    symbol->idx);
+            fprintf(out, "\tpop pointer 1\n");
+            fprintf(out, "\tpop that 0\n");
+            thatBase = NULL;
+
+          } else if (isArray) {
             fprintf(out, "\tpop temp 0\n");
             fprintf(out, "\tpop pointer 1\n");
             fprintf(out, "\tpush temp 0\n");
             fprintf(out, "\tpop that 0\n");
+            thatBase = NULL;
 
           } else {
             switch (symbol->kind) {
@@ -928,6 +1669,7 @@ void compLet() {
   if (errno) {
     fprintf(stderr, "[%zu:%zu] Syntax error: invalid let statement\n", t->lineN,
             t->lineP);
+    nErrors++;
     errno = 0;
   }
 }
@@ -936,15 +1678,14 @@ void compSubroutineCall() {
   /* subroutineName '(' expressionList ')' | (className |
    * varName) '.' subroutineName '(' expressionList ')'  */
   Token *id1 = NULL, *id2 = NULL;
-  Symbol *name = NULL;
-  int nArgs = 0;
+  Symbol *name = NULL, *sub = NULL;
+  char callee[MAX_LINE_LENGTH * 2];
+  int nArgs = 0, nThis = 0;
   if (t->type == IDENTIFIER) {
+    id1 = t;
     name = st_get(sst, t->data.strVal);
     if (!name)
       name = st_get(cst, t->data.strVal);
-    if (!name)
-      id1 = t;
-
     t = t->next;
 
     if (t->type == SYMBOL && t->data.symbol == '.') {
@@ -956,28 +1697,56 @@ void compSubroutineCall() {
 
       } else
         errno = PARSING_ERROR;
-    } else
+    }
+
+    if (id2 && name) {
+      snprintf(callee, sizeof(callee), "%s.%s", name->type, id2->data.strVal);
+    } else if (id2) {
+      snprintf(callee, sizeof(callee), "%s.%s", id1->data.strVal,
+               id2->data.strVal);
+    } else {
+      snprintf(callee, sizeof(callee), "%s.%s", className, id1->data.strVal);
+    }
+    sub = st_get(classIndex, callee);
+
+    // The object a method is called on goes first, as argument 0
+    if (id2 && name) {
+      fprintf(out, "\tpush %s %zu\n",
+              (name->kind == FIELD_) ? "this" : symbol_kind[name->kind],
+              name->idx);
+      nThis = 1;
+    } else if (!id2 && !(sub && strcmp(sub->type, "method"))) {
       fprintf(out, "\tpush pointer 0\n");
+      nThis = 1;
+    }
 
     if (t->type == SYMBOL && t->data.symbol == '(') {
       t = t->next;
 
       nArgs += compExpressionList();
 
-      if (id2) {
-        if (name) {
-          fprintf(out, "\tpush %s %zu\n",
-                  (name->kind == FIELD_) ? "this" : symbol_kind[name->kind],
-                  name->idx);
-          fprintf(out, "\tcall %s.%s %d\n", name->type, id2->data.strVal,
-                  ++nArgs);
-
-        } else
-          fprintf(out, "\tcall %s.%s %d\n", id1->data.strVal, id2->data.strVal,
-                  nArgs);
-
-      } else
-        fprintf(out, "\tcall %s.%s %d\n", className, id1->data.strVal, ++nArgs);
+      if (sub) {
+        char const *problem = NULL;
+        if (!strcmp(sub->type, "method")) {
+          if (id2 && !name)
+            problem = "method called without an object";
+          else if (!id2 && subKind == FUNCTION)
+            problem = "method called from a function";
+        } else if (id2 && name) {
+          problem = "not a method";
+        }
+        if (problem) {
+          fprintf(stderr, "[%zu:%zu] Error: %s: %s\n", id1->lineN, id1->lineP,
+                  callee, problem);
+          nErrors++;
+        } else if ((size_t)nArgs != sub->idx) {
+          fprintf(stderr, "[%zu:%zu] Error: %s expects %zu arguments, got %d\n",
+                  id1->lineN, id1->lineP, callee, sub->idx, nArgs);
+          nErrors++;
+        }
+      }
+      fprintf(out, "\tcall %s %d\n", callee, nArgs + nThis);
+      thatBase = NULL;
 
       if (t->type == SYMBOL && t->data.symbol == ')') {
         t = t->next;
@@ -991,6 +1760,7 @@ void compSubroutineCall() {
   if (errno) {
     fprintf(stderr, "[%zu:%zu] Syntax error: invalid subroutine call\n",
             t->lineN, t->lineP);
+    nErrors++;
     errno = 0;
   }
 }
@@ -1009,6 +1779,7 @@ void compDo() {
   if (errno) {
     fprintf(stderr, "[%zu:%zu] Syntax error: invalid do statement\n", t->lineN,
             t->lineP);
+    nErrors++;
     errno = 0;
   }
 }
@@ -1017,6 +1788,12 @@ void compStatements() {
   /* (letStatement | ifStatement | whileStatement |
    * doStatement | returnStatement)* */
   for (;;) {
+    thatBase = NULL;
+    if (debugInfo && t->type == KEYWORD &&
+        (t->data.keyword == DO || t->data.keyword == LET ||
+         t->data.keyword == IF || t->data.keyword == WHILE ||
+         t->data.keyword == RETURN))
+      fprintf(out, "// line %zu\n", t->lineN);
     if (t->type == KEYWORD && t->data.keyword == DO) {
       t = t->next;
       compDo();
@@ -1044,6 +1821,7 @@ void compStatements() {
   if (errno) {
     fprintf(stderr, "[%zu:%zu] Syntax error: invalid statement\n", t->lineN,
             t->lineP);
+    nErrors++;
     errno = 0;
   }
 }
@@ -1103,6 +1881,7 @@ int compVarDec() {
   if (errno) {
     fprintf(stderr, "[%zu:%zu] Syntax error: invalid variable declaration\n",
             t->lineN, t->lineP);
+    nErrors++;
     errno = 0;
   }
   return nVars;
@@ -1159,6 +1938,7 @@ void compParameterList() {
   if (errno) {
     fprintf(stderr, "[%zu:%zu] Syntax error: invalid parameters\n", t->lineN,
             t->lineP);
+    nErrors++;
     errno = 0;
   }
 }
@@ -1168,6 +1948,7 @@ void compSubroutine() {
    * '(' parameterList ')' subroutineBody */
   for (;;) {
     Token *name;
+    size_t line = t->lineN;
     int nVars = 0;
     bool isConstructor = false;
     bool isMethod = false;
@@ -1179,6 +1960,7 @@ void compSubroutine() {
     if (t->type == KEYWORD &&
         (t->data.keyword == CONSTRUCTOR || t->data.keyword == FUNCTION ||
          t->data.keyword == METHOD)) {
+      subKind = t->data.keyword;
       if (t->data.keyword == METHOD) {
         isMethod = true;
       } else if (t->data.keyword == CONSTRUCTOR) {
@@ -1190,8 +1972,8 @@ void compSubroutine() {
            (t->data.keyword == VOID || t->data.keyword == INT ||
             t->data.keyword == CHAR || t->data.keyword == BOOLEAN)) ||
           (t->type == IDENTIFIER)) {
-        if (isMethod && t->type == IDENTIFIER) {
-          st_set(sst, "this", t->data.strVal, ARGUMENT_);
+        if (isMethod) {
+          st_set(sst, "this", className, ARGUMENT_);
         }
         t = t->next;
 
@@ -1212,8 +1994,20 @@ void compSubroutine() {
 
                 nVars += compVarDec();
 
+                // Buffer the body so dead code can be pruned before writing
+                FILE *file = out;
+                char *buf = NULL;
+                size_t size = 0;
+                out = open_memstream(&buf, &size);
+                if (out == NULL) {
+                  perror("Error opening memory stream");
+                  out = file;
+                }
+
                 fprintf(out, "function %s.%s %d\n", className,
                         name->data.strVal, nVars);
+                if (debugInfo)
+                  fprintf(out, "// line %zu\n", line);
                 if (isConstructor) {
                   fprintf(out, "\tpush constant %zu\n", cst->length);
                   fprintf(out, "\tcall Memory.alloc 1\n");
@@ -1225,6 +2019,13 @@ void compSubroutine() {
 
                 compStatements();
 
+                if (out != file) {
+                  fclose(out);
+                  out = file;
+                  optimize_function(buf, out);
+                }
+                free(buf);
+
                 if (t->type == SYMBOL && t->data.symbol == '}') {
                   t = t->next;
 
@@ -1250,6 +2051,7 @@ void compSubroutine() {
     fprintf(stderr, "[%zu:%zu] Syntax error: invalid subroutine declaration\n",
             t->lineN, t->lineP);
     fprintf(stderr, "%c\n", t->data.symbol);
+    nErrors++;
     errno = 0;
   }
 }
@@ -1308,6 +2110,7 @@ void compClassVarDec() {
     fprintf(stderr,
             "[%zu:%zu] Syntax error: invalid class variable declaration\n",
             t->lineN, t->lineP);
+    nErrors++;
     errno = 0;
   }
 }
@@ -1324,6 +2127,7 @@ void compClass() {
 
     if (t->type == IDENTIFIER) {
       strcpy((char *)className, t->data.strVal);
+      gotoInc = 0;
       t = t->next;
 
       if (t->type == SYMBOL && t->data.symbol == '{') {
@@ -1343,26 +2147,352 @@ void compClass() {
   if (errno) {
     fprintf(stderr, "[%zu:%zu] Syntax error: invalid class\n", t->lineN,
             t->lineP);
+    nErrors++;
     errno = 0;
   }
   cst = st_del(cst);
 }
-// handle_file {{{1
-void handle_file(FILE *in) {
-  TokenList *tl = tokenize_file(in);
-  // token_list_dump(tl);
-  t = tl->head;
-  compClass();
-  token_list_del(tl);
+// compile_class {{{1
+bool compile_class(char const *path, TokenList *tl) {
+  // Writes the .vm file next to the class source, false on errors
+  size_t errors = nErrors;
+  char vm_path[PATH_MAX];
+  strcpy(vm_path, path);
+  strcpy(strrchr(vm_path, '.'), ".vm");
+  errno = 0;
+  out = fopen(vm_path, "w");
+  if (out) {
+    // token_list_dump(tl);
+    t = tl->head;
+    if (t)
+      compClass();
+    fclose(out);
+  } else {
+    perror("Error opening/creating file");
+    nErrors++;
+  }
+  errno = 0;
+  return nErrors == errors;
+}
+// compile_files {{{1
+void compile_files(char **paths, size_t n) {
+  /* Tokenizes every class first so calls can be checked against the
+   * subroutines of the whole program, then writes a .vm file per class.
+   * Classes whose source and .vm file are unchanged since the last run are
+   * skipped, as long as no subroutine of any class changed its signature. */
+  if (n == 0)
+    return;
+  TokenList **tls = calloc(n, sizeof(TokenList *));
+  uint64_t *hashes = calloc(n, sizeof(uint64_t));
+  Cache *next = cache_new(n);
+  classIndex = st_new();
+  if (tls == NULL || hashes == NULL || next == NULL || classIndex == NULL) {
+    perror("Allocation error");
+    free(tls);
+    free(hashes);
+    if (next)
+      cache_del(next);
+    if (classIndex)
+      classIndex = st_del(classIndex);
+    return;
+  }
+
+  char cache_path[PATH_MAX];
+  char vm_path[PATH_MAX];
+  strcpy(cache_path, paths[0]);
+  char *slash = strrchr(cache_path, SLASH);
+  if (slash)
+    *slash = '\0';
+  size_t dirLength = strlen(cache_path);
+  snprintf(cache_path + dirLength, sizeof(cache_path) - dirLength, "%c%s",
+           SLASH, CACHE_DIR);
+  int saved = errno;
+  mkdir(cache_path, 0755);
+  errno = saved;
+  dirLength = strlen(cache_path);
+  snprintf(cache_path + dirLength, sizeof(cache_path) - dirLength, "%c%s",
+           SLASH, CACHE_FILE);
+  Cache *cache = cache_load(cache_path);
+
+  for (size_t i = 0; i < n; i++) {
+    char *name = strrchr(paths[i], SLASH);
+    name = (name) ? name + 1 : paths[i];
+    CacheEntry *entry = &next->entries[next->length++];
+    strncpy(entry->name, name, sizeof(entry->name) - 1);
+    hashes[i] = file_hash(paths[i]);
+    strcpy(vm_path, paths[i]);
+    strcpy(strrchr(vm_path, '.'), ".vm");
+
+    CacheEntry *old = (cache) ? cache_find(cache, entry->name) : NULL;
+    if (old && old->subs && old->source == hashes[i] &&
+        old->vm == file_hash(vm_path)) {
+      entry->subs = old->subs;
+      old->subs = NULL;
+      entry->source = old->source;
+      entry->vm = old->vm;
+    } else {
+      FILE *file = fopen(paths[i], "r");
+      if (file) {
+        tls[i] = tokenize_file(file);
+        entry->subs = st_new();
+        if (tls[i] && entry->subs)
+          index_class(entry->subs, tls[i]);
+        fclose(file);
+      } else
+        perror("Error opening file");
+    }
+    if (entry->subs) {
+      for (size_t j = 0; j < entry->subs->capacity; j++) {
+        Symbol *sub = &entry->subs->entries[j];
+        if (sub->name)
+          st_put(classIndex, sub->name, sub->type, sub->kind, sub->idx);
+      }
+      next->signature ^= signature_hash(entry->subs);
+    }
+  }
+
+  /* -g changes the code of every class, a changed signature the code of
+   * any caller */
+  if (debugInfo)
+    next->signature = ~next->signature;
+  if (cache == NULL || cache->signature != next->signature) {
+    for (size_t i = 0; i < n; i++) {
+      if (tls[i] == NULL) {
+        FILE *file = fopen(paths[i], "r");
+        if (file) {
+          tls[i] = tokenize_file(file);
+          fclose(file);
+        }
+      }
+    }
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    if (tls[i] == NULL)
+      continue;
+    bool ok = compile_class(paths[i], tls[i]);
+    token_list_del(tls[i]);
+    // Classes with errors are compiled again on the next run
+    next->entries[i].source = (ok) ? hashes[i] : 0;
+    strcpy(vm_path, paths[i]);
+    strcpy(strrchr(vm_path, '.'), ".vm");
+    next->entries[i].vm = file_hash(vm_path);
+  }
+
+  cache_save(next, cache_path);
+  if (cache)
+    cache = cache_del(cache);
+  next = cache_del(next);
+  free(tls);
+  free(hashes);
+  classIndex = st_del(classIndex);
+}
+// watch_directory {{{1
+typedef struct {
+  char *path;
+  TokenList *tl;
+  SymbolTable *subs;
+  uint64_t signature;
+  bool dirty;
+} WatchedClass;
+
+bool load_class(WatchedClass *self) {
+  // Retokenizes and reindexes the class, true if its signatures changed
+  uint64_t signature = self->signature;
+  if (self->tl)
+    token_list_del(self->tl);
+  self->tl = NULL;
+  if (self->subs)
+    self->subs = st_del(self->subs);
+  self->signature = 0;
+  errno = 0;
+  FILE *file = fopen(self->path, "r");
+  if (file == NULL) {
+    perror("Error opening file");
+    errno = 0;
+    return signature != 0;
+  }
+  self->tl = tokenize_file(file);
+  fclose(file);
+  errno = 0;
+  self->subs = st_new();
+  if (self->tl && self->subs) {
+    index_class(self->subs, self->tl);
+    self->signature = signature_hash(self->subs);
+  }
+  return signature != self->signature;
+}
+
+void watch_directory(char const *dir, char **paths, size_t n,
+                     char const *hook) {
+  /* Keeps the tokens and subroutines of every class in memory and compiles
+   * a class again whenever its source is written. A class whose signatures
+   * change rebuilds every class, as any caller may be affected, and so does
+   * a deleted class, which is forgotten. The hook
+   * command runs after each rebuild without errors, e.g. to translate and
+   * assemble the program. */
+  int fd = inotify_init();
+  if (fd == -1 ||
+      inotify_add_watch(fd, dir,
+                        IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE |
+                            IN_MOVED_FROM) == -1) {
+    perror("Error watching directory");
+    return;
+  }
+  size_t capacity = (n) ? n : 1;
+  WatchedClass *classes = calloc(capacity, sizeof(WatchedClass));
+  if (classes == NULL) {
+    perror("Failed to allocate memory!");
+    close(fd);
+    return;
+  }
+  for (size_t i = 0; i < n; i++) {
+    classes[i].path = strdup(paths[i]);
+    load_class(&classes[i]);
+  }
+
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  fprintf(stderr, "Watching %s\n", dir);
+  for (;;) {
+    ssize_t length = read(fd, buf, sizeof(buf));
+    if (length <= 0) {
+      if (length == -1 && errno == EINTR)
+        continue;
+      perror("Error reading events");
+      break;
+    }
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // Editors often write a file several times, one rebuild per batch
+    bool changed = false, removed = false;
+    for (char *ptr = buf; ptr < buf + length;) {
+      struct inotify_event *event = (struct inotify_event *)ptr;
+      ptr += sizeof(struct inotify_event) + event->len;
+      char *dot = (event->len) ? strrchr(event->name, '.') : NULL;
+      if (dot == NULL || strcmp(dot, ".jack"))
+        continue;
+      size_t i = 0;
+      for (; i < n; i++) {
+        char *name = strrchr(classes[i].path, SLASH);
+        if (!strcmp(name ? name + 1 : classes[i].path, event->name))
+          break;
+      }
+      if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+        if (i == n)
+          continue;
+        free(classes[i].path);
+        if (classes[i].tl)
+          token_list_del(classes[i].tl);
+        if (classes[i].subs)
+          st_del(classes[i].subs);
+        classes[i] = classes[--n];
+        cache_forget(dir, event->name);
+        changed = removed = true;
+        continue;
+      }
+      if (i == n) {
+        if (n == capacity) {
+          WatchedClass *grown =
+              realloc(classes, 2 * capacity * sizeof(WatchedClass));
+          if (grown == NULL) {
+            perror("Failed to allocate memory!");
+            continue;
+          }
+          classes = grown;
+          capacity *= 2;
+        }
+        classes[n] = (WatchedClass){0};
+        classes[n].path = malloc(PATH_MAX);
+        if (classes[n].path == NULL) {
+          perror("Failed to allocate memory!");
+          continue;
+        }
+        snprintf(classes[n].path, PATH_MAX, "%s%c%s", dir, SLASH,
+                 event->name);
+        n++;
+      }
+      classes[i].dirty = true;
+      changed = true;
+    }
+    if (!changed)
+      continue;
+
+    bool all = removed;
+    for (size_t i = 0; i < n; i++)
+      if (classes[i].dirty && load_class(&classes[i]))
+        all = true;
+
+    classIndex = st_new();
+    if (classIndex == NULL) {
+      perror("Allocation error");
+      break;
+    }
+    for (size_t i = 0; i < n; i++) {
+      if (classes[i].subs == NULL)
+        continue;
+      for (size_t j = 0; j < classes[i].subs->capacity; j++) {
+        Symbol *sub = &classes[i].subs->entries[j];
+        if (sub->name)
+          st_put(classIndex, sub->name, sub->type, sub->kind, sub->idx);
+      }
+    }
+    size_t errors = nErrors, compiled = 0;
+    for (size_t i = 0; i < n; i++) {
+      if ((all || classes[i].dirty) && classes[i].tl) {
+        compile_class(classes[i].path, classes[i].tl);
+        compiled++;
+      }
+      classes[i].dirty = false;
+    }
+    classIndex = st_del(classIndex);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fprintf(stderr, "Compiled %zu of %zu classes in %.3f ms\n", compiled, n,
+            (end.tv_sec - start.tv_sec) * 1e3 +
+                (end.tv_nsec - start.tv_nsec) / 1e6);
+    if (nErrors == errors && hook) {
+      int status = system(hook);
+      if (status)
+        fprintf(stderr, "Hook exited with status %d\n", status);
+    }
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    free(classes[i].path);
+    if (classes[i].tl)
+      token_list_del(classes[i].tl);
+    if (classes[i].subs)
+      st_del(classes[i].subs);
+  }
+  free(classes);
+  close(fd);
 }
 // main {{{1
 int main(int argc, char *argv[]) {
-  if (argc < 2) {
-    fprintf(stderr, "Usage: %s <path>\n", argv[0]);
+  bool watch = false;
+  char const *hook = NULL; // Command run after every rebuild in watch mode
+  for (int opt; (opt = getopt(argc, argv, "gwx:")) != -1;) {
+    switch (opt) {
+    case 'g':
+      debugInfo = true;
+      break;
+    case 'w':
+      watch = true;
+      break;
+    case 'x':
+      hook = optarg;
+      break;
+    default:
+      optind = argc;
+    }
+  }
+  if (optind != argc - 1) {
+    fprintf(stderr, "Usage: %s [-g] [-w] [-x <command>] <path>\n", argv[0]);
     return EXIT_FAILURE;
   }
 
-  char *path = realpath(argv[1], NULL);
+  char *path = realpath(argv[optind], NULL);
   if (path == NULL) {
     perror("Couldn't resolve path");
     return EXIT_FAILURE;
@@ -1382,57 +2512,52 @@ int main(int argc, char *argv[]) {
   }
 
   if (S_ISREG(path_stat->st_mode)) {
-    FILE *file = fopen(path, "r");
-    if (file) {
-      char *dot = strrchr(path, '.');
-      if (dot && !strcmp(dot, ".jack")) {
-        strcpy(dot, ".vm");
-        out = fopen(path, "w");
-        if (out) {
-          handle_file(file);
-          fclose(out);
-        } else
-          fprintf(stderr, "Error creating output file: %s\n", path);
-      } else
-        fprintf(stderr, "Invalid file path\n");
-
-      fclose(file);
+    char *dot = strrchr(path, '.');
+    if (dot && !strcmp(dot, ".jack")) {
+      compile_files(&path, 1);
+      if (watch) {
+        char *dir = strdup(path);
+        if (dir) {
+          *strrchr(dir, SLASH) = '\0';
+          watch_directory(dir, &path, 1, hook);
+          free(dir);
+        }
+      }
     } else
-      perror("Error opening file");
+      fprintf(stderr, "Invalid file path\n");
 
   } else if (S_ISDIR(path_stat->st_mode)) {
     DIR *dir = opendir(path);
     if (dir) {
       struct dirent *entry;
+      char **paths = NULL;
+      size_t n = 0;
       while ((entry = readdir(dir))) {
         if (entry->d_type == DT_REG || entry->d_type == DT_UNKNOWN) {
-          char *file_path = malloc(PATH_MAX);
-          if (file_path) {
-            char *dot = strrchr(entry->d_name, '.');
-            if (dot && !strcmp(dot, ".jack")) {
+          char *dot = strrchr(entry->d_name, '.');
+          if (dot && !strcmp(dot, ".jack")) {
+            char **grown = realloc(paths, (n + 1) * sizeof(char *));
+            char *file_path = malloc(PATH_MAX);
+            if (grown && file_path) {
+              paths = grown;
               snprintf(file_path, PATH_MAX, "%s%c%s", path, SLASH,
                        entry->d_name);
-              FILE *file = fopen(file_path, "r");
-              if (file) {
-                strcpy(dot, ".vm");
-                snprintf(file_path, PATH_MAX, "%s%c%s", path, SLASH,
-                         entry->d_name);
-                out = fopen(file_path, "w");
-                if (out) {
-                  handle_file(file);
-                  fclose(out);
-                } else
-                  perror("Error opening/creating file");
-                fclose(file);
-              } else
-                perror("Error opening file");
+              paths[n++] = file_path;
+            } else {
+              perror("Error allocating memory");
+              paths = (grown) ? grown : paths;
+              free(file_path);
             }
-            free(file_path);
-          } else
-            perror("Error allocating memory");
+          }
         }
       }
       closedir(dir);
+      compile_files(paths, n);
+      if (watch)
+        watch_directory(path, paths, n, hook);
+      for (size_t i = 0; i < n; i++)
+        free(paths[i]);
+      free(paths);
     } else
       perror("Error opening directory");
   } else {
@@ -1440,5 +2565,5 @@ int main(int argc, char *argv[]) {
   }
   free(path_stat);
   free(path);
-  return (errno) ? EXIT_FAILURE : EXIT_SUCCESS;
+  return (errno || nErrors) ? EXIT_FAILURE : EXIT_SUCCESS;
 }
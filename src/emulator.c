@@ -0,0 +1,1120 @@
+//
+// definitions {{{1
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MAX_LINE_LENGTH 128
+#define INITIAL_CAPACITY 16
+#define ROM_SIZE 32768U
+#define RAM_SIZE 32768U
+#define SCREEN_ADDRESS 16384U
+#define KEYBOARD_ADDRESS 24576U
+#define SYMBOL_MAP_EXT ".map"
+#define RETURN_LABEL "$__return_"
+#define RAM_EXT ".ram"
+#define FRAMES_EXT ".frames"
+
+// machine {{{1
+// declarations {{{2
+typedef struct {
+  uint16_t rom[ROM_SIZE];
+  int16_t ram[RAM_SIZE];
+  size_t romLength;
+  int16_t a;
+  int16_t d;
+  uint16_t pc;
+  uint64_t cycles;
+  bool halted; // Reached a jump to itself, the end of every Hack program
+} Machine;
+
+typedef struct Profile Profile;
+void profile_del(Profile *self);
+void profile_jump(Profile *self, uint16_t from, uint16_t pc, uint64_t cycles);
+void profile_hit(Profile *self, uint16_t pc);
+// machine_new {{{2
+Machine *machine_new(void) {
+  Machine *self = calloc(1, sizeof(Machine));
+  if (self == NULL)
+    perror("Failed to allocate memory!");
+  return self;
+}
+// machine_load {{{2
+bool machine_load(Machine *self, char const *path) {
+  // Reads a .hack file, one instruction of 16 binary digits per line
+  char line[MAX_LINE_LENGTH];
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    perror(path);
+    return false;
+  }
+  self->romLength = 0;
+  for (size_t lineNumber = 1; fgets(line, sizeof(line), file); lineNumber++) {
+    size_t length = strspn(line, "01");
+    if (length == 0 && strspn(line, " \t\r\n") == strlen(line))
+      continue;
+    if (length != 16 || self->romLength == ROM_SIZE) {
+      fprintf(stderr, "%s:%zu: Invalid instruction\n", path, lineNumber);
+      fclose(file);
+      return false;
+    }
+    self->rom[self->romLength++] = (uint16_t)strtoul(line, NULL, 2);
+  }
+  fclose(file);
+  return true;
+}
+// machine_run {{{2
+void machine_run(Machine *self, uint64_t budget, Profile *profile) {
+  /* Executes until the program halts or the cycle budget, 0 for none, is
+   * used up. Every instruction takes one cycle. */
+  uint16_t pc = self->pc;
+  int16_t a = self->a, d = self->d;
+  uint64_t cycles = self->cycles;
+  while (!self->halted && (!budget || cycles < budget)) {
+    uint16_t instr = self->rom[pc];
+    if (profile)
+      profile_hit(profile, pc);
+    cycles++;
+    if (!(instr & 0x8000)) {
+      a = (int16_t)instr;
+      pc++;
+      continue;
+    }
+    uint16_t address = (uint16_t)a & (RAM_SIZE - 1);
+    int16_t x = d;
+    int16_t y = (instr & 0x1000) ? self->ram[address] : a;
+    if (instr & 0x0800)
+      x = 0;
+    if (instr & 0x0400)
+      x = ~x;
+    if (instr & 0x0200)
+      y = 0;
+    if (instr & 0x0100)
+      y = ~y;
+    int16_t out = (instr & 0x0080) ? (int16_t)(x + y) : (x & y);
+    if (instr & 0x0040)
+      out = ~out;
+    if (instr & 0x0008)
+      self->ram[address] = out;
+    if (instr & 0x0020)
+      a = out;
+    if (instr & 0x0010)
+      d = out;
+    if (((instr & 4) && out < 0) || ((instr & 2) && out == 0) ||
+        ((instr & 1) && out > 0)) {
+      uint16_t target = (uint16_t)a & (ROM_SIZE - 1);
+      if (target == pc - 1 && self->rom[target] == target) {
+        self->halted = true;
+        break;
+      }
+      if (profile)
+        profile_jump(profile, pc, target, cycles);
+      pc = target;
+    } else
+      pc++;
+  }
+  self->pc = pc;
+  self->a = a;
+  self->d = d;
+  self->cycles = cycles;
+}
+// profiler {{{1
+// declarations {{{2
+typedef struct CallNode {
+  size_t function;
+  uint64_t calls;
+  uint64_t self; // Cycles spent in this call path, callees excluded
+  struct CallNode *parent;
+  struct CallNode *child;
+  struct CallNode *sibling;
+} CallNode;
+typedef struct {
+  CallNode *node;
+  uint64_t start; // Cycle the call was made on
+} Frame;
+typedef struct {
+  char *name;
+  uint16_t address;
+  uint64_t calls;
+  uint64_t inclusive;
+  uint64_t exclusive;
+  size_t active; // Frames of the function on the call stack
+} Function;
+struct Profile {
+  Function *functions; // Sorted by address, the bootstrap first
+  size_t nFunctions;
+  size_t entry[ROM_SIZE];  // Function + 1 starting at every address
+  bool returns[ROM_SIZE];  // Addresses that are the target of a return
+  uint64_t hits[ROM_SIZE]; // Executions of every instruction
+  CallNode root;
+  Frame *stack;
+  size_t depth;
+  size_t capacity;
+  uint64_t since; // Cycle the current call path was entered on
+};
+// profile_new {{{2
+static int by_address(const void *a, const void *b) {
+  const Function *x = a, *y = b;
+  return (x->address > y->address) - (x->address < y->address);
+}
+
+Profile *profile_new(char const *map_path) {
+  /* Reads the labels of a symbol map written by the assembler with -g.
+   * Labels without a '$' start functions, the return labels of calls are
+   * where functions return to. */
+  char line[MAX_LINE_LENGTH];
+  char name[MAX_LINE_LENGTH];
+  unsigned address;
+  FILE *map = fopen(map_path, "r");
+  if (map == NULL) {
+    perror(map_path);
+    return NULL;
+  }
+  Profile *self = calloc(1, sizeof(Profile));
+  size_t capacity = INITIAL_CAPACITY;
+  if (self)
+    self->functions = malloc(capacity * sizeof(Function));
+  if (self == NULL || self->functions == NULL) {
+    perror("Failed to allocate memory!");
+    free(self);
+    fclose(map);
+    return NULL;
+  }
+  self->functions[self->nFunctions++] =
+      (Function){.name = strdup("Bootstrap"), .address = 0};
+  while (fgets(line, sizeof(line), map)) {
+    if (sscanf(line, "label %u %127s", &address, name) != 2 ||
+        address >= ROM_SIZE)
+      continue;
+    if (strstr(name, RETURN_LABEL)) {
+      self->returns[address] = true;
+    } else if (!strchr(name, '$')) {
+      if (self->nFunctions == capacity) {
+        Function *grown =
+            realloc(self->functions, 2 * capacity * sizeof(Function));
+        if (grown == NULL) {
+          perror("Failed to allocate memory!");
+          break;
+        }
+        self->functions = grown;
+        capacity *= 2;
+      }
+      self->functions[self->nFunctions++] =
+          (Function){.name = strdup(name), .address = address};
+    }
+  }
+  fclose(map);
+  qsort(self->functions + 1, self->nFunctions - 1, sizeof(Function),
+        by_address);
+  for (size_t i = 1; i < self->nFunctions; i++)
+    self->entry[self->functions[i].address] = i + 1;
+
+  self->root.calls = 1;
+  self->root.function = 0;
+  self->capacity = INITIAL_CAPACITY;
+  self->stack = malloc(self->capacity * sizeof(Frame));
+  if (self->stack == NULL) {
+    perror("Failed to allocate memory!");
+    profile_del(self);
+    return NULL;
+  }
+  self->stack[self->depth++] = (Frame){&self->root, 0};
+  self->functions[0].active = 1;
+  return self;
+}
+// profile_del {{{2
+static void call_node_del(CallNode *node) {
+  while (node) {
+    CallNode *next = node->sibling;
+    call_node_del(node->child);
+    free(node);
+    node = next;
+  }
+}
+
+void profile_del(Profile *self) {
+  call_node_del(self->root.child);
+  for (size_t i = 0; i < self->nFunctions; i++)
+    free(self->functions[i].name);
+  free(self->functions);
+  free(self->stack);
+  free(self);
+}
+// profile_hit {{{2
+void profile_hit(Profile *self, uint16_t pc) { self->hits[pc]++; }
+// profile_jump {{{2
+void profile_jump(Profile *self, uint16_t from, uint16_t pc, uint64_t cycles) {
+  /* Follows calls and returns by where jumps land. A jump to the start of
+   * a function is a call when its return label follows the jump, as a loop
+   * may start there too, and one to a return label a return. */
+  size_t f = ((size_t)from + 1 < ROM_SIZE && self->returns[from + 1])
+                 ? self->entry[pc]
+                 : 0;
+  if (!f && !self->returns[pc])
+    return;
+  Frame *top = &self->stack[self->depth - 1];
+  top->node->self += cycles - self->since;
+  self->since = cycles;
+
+  if (f) {
+    f--;
+    CallNode *node = top->node->child;
+    while (node && node->function != f)
+      node = node->sibling;
+    if (node == NULL) {
+      node = calloc(1, sizeof(CallNode));
+      if (node == NULL) {
+        perror("Failed to allocate memory!");
+        return;
+      }
+      node->function = f;
+      node->parent = top->node;
+      node->sibling = top->node->child;
+      top->node->child = node;
+    }
+    if (self->depth == self->capacity) {
+      Frame *grown = realloc(self->stack, 2 * self->capacity * sizeof(Frame));
+      if (grown == NULL) {
+        perror("Failed to allocate memory!");
+        return;
+      }
+      self->stack = grown;
+      self->capacity *= 2;
+    }
+    node->calls++;
+    self->functions[f].calls++;
+    self->functions[f].active++;
+    self->stack[self->depth++] = (Frame){node, cycles};
+  } else if (self->depth > 1) {
+    // Recursive calls count once towards the inclusive time
+    Function *function = &self->functions[top->node->function];
+    if (--function->active == 0)
+      function->inclusive += cycles - top->start;
+    self->depth--;
+  }
+}
+// profile_finish {{{2
+void profile_finish(Profile *self, uint64_t cycles) {
+  // Closes the frames still open when the program stopped
+  self->stack[self->depth - 1].node->self += cycles - self->since;
+  self->since = cycles;
+  while (self->depth > 0) {
+    Frame *top = &self->stack[--self->depth];
+    Function *function = &self->functions[top->node->function];
+    if (--function->active == 0)
+      function->inclusive += cycles - top->start;
+  }
+  size_t f = 0;
+  for (size_t pc = 0; pc < ROM_SIZE; pc++) {
+    while (f + 1 < self->nFunctions && self->functions[f + 1].address <= pc)
+      f++;
+    self->functions[f].exclusive += self->hits[pc];
+  }
+}
+// profile_report {{{2
+typedef struct {
+  size_t caller;
+  size_t callee;
+  uint64_t calls;
+} Edge;
+
+static int by_exclusive(const void *a, const void *b) {
+  const Function *x = *(Function *const *)a, *y = *(Function *const *)b;
+  return (x->exclusive < y->exclusive) - (x->exclusive > y->exclusive);
+}
+
+static int by_edge(const void *a, const void *b) {
+  const Edge *x = a, *y = b;
+  if (x->caller != y->caller)
+    return (x->caller > y->caller) - (x->caller < y->caller);
+  return (x->callee > y->callee) - (x->callee < y->callee);
+}
+
+static size_t collect_edges(CallNode *node, Edge *edges, size_t n) {
+  for (CallNode *child = node->child; child; child = child->sibling) {
+    edges[n++] = (Edge){node->function, child->function, child->calls};
+    n = collect_edges(child, edges, n);
+  }
+  return n;
+}
+
+static size_t count_nodes(CallNode *node) {
+  size_t n = 0;
+  for (CallNode *child = node->child; child; child = child->sibling)
+    n += 1 + count_nodes(child);
+  return n;
+}
+
+void profile_report(Profile *self, uint64_t cycles, FILE *output) {
+  /* Lists the functions by the cycles spent in them, then every caller and
+   * callee pair with the number of calls between them */
+  Function **sorted = malloc(self->nFunctions * sizeof(Function *));
+  size_t nNodes = count_nodes(&self->root);
+  Edge *edges = malloc((nNodes + 1) * sizeof(Edge));
+  if (sorted == NULL || edges == NULL) {
+    perror("Failed to allocate memory!");
+    free(sorted);
+    free(edges);
+    return;
+  }
+  for (size_t i = 0; i < self->nFunctions; i++)
+    sorted[i] = &self->functions[i];
+  qsort(sorted, self->nFunctions, sizeof(Function *), by_exclusive);
+
+  fprintf(output, "%7s %12s %7s %12s %10s  %s\n", "self%", "self", "total%",
+          "total", "calls", "function");
+  for (size_t i = 0; i < self->nFunctions; i++) {
+    Function *f = sorted[i];
+    if (!f->exclusive && !f->calls)
+      continue;
+    fprintf(output, "%6.2f%% %12llu %6.2f%% %12llu %10llu  %s\n",
+            (cycles) ? 100.0 * f->exclusive / cycles : 0,
+            (unsigned long long)f->exclusive,
+            (cycles) ? 100.0 * f->inclusive / cycles : 0,
+            (unsigned long long)f->inclusive, (unsigned long long)f->calls,
+            f->name);
+  }
+
+  size_t n = collect_edges(&self->root, edges, 0);
+  qsort(edges, n, sizeof(Edge), by_edge);
+  fprintf(output, "\n%10s  %s\n", "calls", "caller -> callee");
+  for (size_t i = 0; i < n;) {
+    Edge edge = edges[i++];
+    while (i < n && !by_edge(&edge, &edges[i]))
+      edge.calls += edges[i++].calls;
+    fprintf(output, "%10llu  %s -> %s\n", (unsigned long long)edge.calls,
+            self->functions[edge.caller].name,
+            self->functions[edge.callee].name);
+  }
+  free(sorted);
+  free(edges);
+}
+// profile_folded {{{2
+static void write_folded(Profile *self, CallNode *node, char *path,
+                         size_t length, FILE *output) {
+  int n = snprintf(path + length, PATH_MAX - length, "%s%s",
+                   (length) ? ";" : "", self->functions[node->function].name);
+  if (n < 0 || length + n >= PATH_MAX)
+    return;
+  length += n;
+  if (node->self)
+    fprintf(output, "%s %llu\n", path, (unsigned long long)node->self);
+  for (CallNode *child = node->child; child; child = child->sibling)
+    write_folded(self, child, path, length, output);
+}
+
+void profile_folded(Profile *self, char const *path) {
+  // One line per call path with the cycles spent in it, for flame graphs
+  char stack[PATH_MAX];
+  FILE *output = fopen(path, "w");
+  if (output == NULL) {
+    perror(path);
+    return;
+  }
+  write_folded(self, &self->root, stack, 0, output);
+  fclose(output);
+}
+// framebuffer {{{1
+// declarations {{{2
+#define SCREEN_WIDTH 512
+#define SCREEN_HEIGHT 256
+#define SCREEN_WORDS (SCREEN_WIDTH * SCREEN_HEIGHT / 16)
+#define CAPTURE_END UINT64_MAX // Captured when the run ends
+#define FNV_OFFSET 14695981039346656037UL
+#define FNV_PRIME 1099511628211UL
+
+typedef struct {
+  uint64_t cycle;
+  uint64_t hash;
+  uint64_t expected; // Hash of the golden frame, 0 for none
+} Capture;
+typedef struct {
+  Capture *captures; // Sorted by cycle
+  size_t length;
+  size_t capacity;
+  char const *prefix; // Frames go to <prefix>.<cycle>.pbm, NULL for none
+  size_t mismatches;
+} Captures;
+// screen_hash {{{2
+uint64_t screen_hash(Machine const *self) {
+  // FNV-1a of the screen words, low byte first
+  uint64_t hash = FNV_OFFSET;
+  for (size_t i = 0; i < SCREEN_WORDS; i++) {
+    uint16_t word = (uint16_t)self->ram[SCREEN_ADDRESS + i];
+    hash = (hash ^ (word & 0xff)) * FNV_PRIME;
+    hash = (hash ^ (word >> 8)) * FNV_PRIME;
+  }
+  return hash;
+}
+// screen_write_pbm {{{2
+static uint8_t reverse_bits(uint8_t b) {
+  b = (uint8_t)((b & 0xf0) >> 4 | (b & 0x0f) << 4);
+  b = (uint8_t)((b & 0xcc) >> 2 | (b & 0x33) << 2);
+  return (uint8_t)((b & 0xaa) >> 1 | (b & 0x55) << 1);
+}
+
+bool screen_write_pbm(Machine const *self, char const *path) {
+  /* The screen has 32 words per row, the lowest bit of a word being its
+   * leftmost pixel and 1 black, as in a binary PBM with the bits of every
+   * byte reversed */
+  uint8_t bytes[SCREEN_WORDS * 2];
+  for (size_t i = 0; i < SCREEN_WORDS; i++) {
+    uint16_t word = (uint16_t)self->ram[SCREEN_ADDRESS + i];
+    bytes[2 * i] = reverse_bits(word & 0xff);
+    bytes[2 * i + 1] = reverse_bits(word >> 8);
+  }
+  FILE *file = fopen(path, "wb");
+  if (file == NULL) {
+    perror(path);
+    return false;
+  }
+  fprintf(file, "P4\n%d %d\n", SCREEN_WIDTH, SCREEN_HEIGHT);
+  bool ok = fwrite(bytes, 1, sizeof(bytes), file) == sizeof(bytes);
+  fclose(file);
+  return ok;
+}
+// captures_add {{{2
+static int by_cycle(const void *a, const void *b) {
+  const Capture *x = a, *y = b;
+  return (x->cycle > y->cycle) - (x->cycle < y->cycle);
+}
+
+bool captures_add(Captures *self, char const *cycle, uint64_t expected) {
+  // Cycles are counts or 'end', for the screen the run ends with
+  if (self->length == self->capacity) {
+    size_t capacity = (self->capacity) ? 2 * self->capacity : INITIAL_CAPACITY;
+    Capture *grown = realloc(self->captures, capacity * sizeof(Capture));
+    if (grown == NULL) {
+      perror("Failed to allocate memory!");
+      return false;
+    }
+    self->captures = grown;
+    self->capacity = capacity;
+  }
+  char *end;
+  uint64_t value = strtoull(cycle, &end, 10);
+  if (!strcmp(cycle, "end"))
+    value = CAPTURE_END;
+  else if (end == cycle || *end) {
+    fprintf(stderr, "Invalid capture cycle %s\n", cycle);
+    return false;
+  }
+  self->captures[self->length++] = (Capture){value, 0, expected};
+  qsort(self->captures, self->length, sizeof(Capture), by_cycle);
+  return true;
+}
+// captures_parse {{{2
+bool captures_parse(Captures *self, char const *list) {
+  // Adds the cycles of a comma separated list
+  char cycle[MAX_LINE_LENGTH];
+  for (char const *c = list; *c;) {
+    size_t length = strcspn(c, ",");
+    if (length >= sizeof(cycle)) {
+      fprintf(stderr, "Invalid capture cycle\n");
+      return false;
+    }
+    memcpy(cycle, c, length);
+    cycle[length] = '\0';
+    if (!captures_add(self, cycle, 0))
+      return false;
+    c += length + (c[length] == ',');
+  }
+  return true;
+}
+// captures_load {{{2
+bool captures_load(Captures *self, char const *path) {
+  /* Adds the frames of a golden file, '<cycle> <hash>' lines as printed for
+   * every captured frame */
+  char line[MAX_LINE_LENGTH];
+  char cycle[MAX_LINE_LENGTH];
+  unsigned long long hash;
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    perror(path);
+    return false;
+  }
+  bool ok = true;
+  while (ok && fgets(line, sizeof(line), file)) {
+    if (sscanf(line, "%127s %llx", cycle, &hash) != 2) {
+      fprintf(stderr, "%s: Invalid frame %s", path, line);
+      ok = false;
+    } else
+      ok = captures_add(self, cycle, hash);
+  }
+  fclose(file);
+  return ok;
+}
+// captures_take {{{2
+void captures_take(Captures *self, Machine const *machine, size_t i) {
+  Capture *capture = &self->captures[i];
+  capture->hash = screen_hash(machine);
+  if (capture->expected && capture->expected != capture->hash)
+    self->mismatches++;
+  if (self->prefix) {
+    char path[PATH_MAX];
+    if (capture->cycle == CAPTURE_END)
+      snprintf(path, sizeof(path), "%s.end.pbm", self->prefix);
+    else
+      snprintf(path, sizeof(path), "%s.%llu.pbm", self->prefix,
+               (unsigned long long)capture->cycle);
+    screen_write_pbm(machine, path);
+  }
+}
+// captures_write {{{2
+void captures_write(Captures const *self, FILE *output, FILE *errors) {
+  // Lists every frame in the format of golden files, mismatches to errors
+  for (size_t i = 0; i < self->length; i++) {
+    Capture const *capture = &self->captures[i];
+    char cycle[MAX_LINE_LENGTH] = "end";
+    if (capture->cycle != CAPTURE_END)
+      snprintf(cycle, sizeof(cycle), "%llu",
+               (unsigned long long)capture->cycle);
+    fprintf(output, "%s %016llx\n", cycle, (unsigned long long)capture->hash);
+    if (errors && capture->expected && capture->expected != capture->hash)
+      fprintf(errors, "Frame %s: %016llx, expected %016llx\n", cycle,
+              (unsigned long long)capture->hash,
+              (unsigned long long)capture->expected);
+  }
+}
+// snapshot {{{1
+// declarations {{{2
+#define SNAPSHOT_MAGIC "HACKSNAP"
+
+typedef struct {
+  char magic[8];
+  uint64_t romId; // Hash of the ROM the state belongs to
+  uint64_t cycles;
+  int16_t a;
+  int16_t d;
+  uint16_t pc;
+  uint16_t halted;
+} SnapshotHeader; // Followed by the RAM, in host byte order
+// rom_hash {{{2
+uint64_t rom_hash(Machine const *self) {
+  uint64_t hash = FNV_OFFSET;
+  for (size_t i = 0; i < self->romLength; i++) {
+    hash = (hash ^ (self->rom[i] & 0xff)) * FNV_PRIME;
+    hash = (hash ^ (self->rom[i] >> 8)) * FNV_PRIME;
+  }
+  return hash;
+}
+// snapshot_save {{{2
+bool snapshot_save(Machine const *self, char const *path) {
+  SnapshotHeader header = {SNAPSHOT_MAGIC, rom_hash(self), self->cycles,
+                           self->a,        self->d,        self->pc,
+                           self->halted};
+  FILE *file = fopen(path, "wb");
+  if (file == NULL) {
+    perror(path);
+    return false;
+  }
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+            fwrite(self->ram, sizeof(int16_t), RAM_SIZE, file) == RAM_SIZE;
+  if (fclose(file) || !ok) {
+    perror(path);
+    return false;
+  }
+  return true;
+}
+// snapshot_restore {{{2
+bool snapshot_restore(Machine *self, char const *path) {
+  /* Continues from the state saved by snapshot_save, which must belong to
+   * the ROM already loaded. Cycle counts go on from the saved one. */
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    perror(path);
+    return false;
+  }
+  struct stat st;
+  size_t size = sizeof(SnapshotHeader) + RAM_SIZE * sizeof(int16_t);
+  if (fstat(fd, &st) || (size_t)st.st_size != size) {
+    fprintf(stderr, "%s: Invalid snapshot\n", path);
+    close(fd);
+    return false;
+  }
+  void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    perror(path);
+    return false;
+  }
+  SnapshotHeader const *header = data;
+  bool ok = !memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic));
+  if (!ok)
+    fprintf(stderr, "%s: Invalid snapshot\n", path);
+  else if (header->romId != rom_hash(self)) {
+    fprintf(stderr, "%s: Snapshot of a different ROM\n", path);
+    ok = false;
+  } else {
+    memcpy(self->ram, header + 1, RAM_SIZE * sizeof(int16_t));
+    self->cycles = header->cycles;
+    self->a = header->a;
+    self->d = header->d;
+    self->pc = header->pc;
+    self->halted = header->halted;
+  }
+  munmap(data, size);
+  return ok;
+}
+// keyboard {{{1
+// declarations {{{2
+typedef struct {
+  uint64_t cycle;
+  int16_t key; // Held from this cycle on, 0 releases it
+} KeyEvent;
+typedef struct {
+  KeyEvent *events;
+  size_t length;
+} KeyScript;
+// key_script_load {{{2
+bool key_script_load(KeyScript *self, char const *path) {
+  /* Reads '<cycle> <key>' lines, sorted by cycle. The key is a Hack key
+   * code, 0 releasing it, or a single character other than a digit standing
+   * for itself: the key of a digit goes by its code, like 48 for '0'. */
+  char line[MAX_LINE_LENGTH];
+  char key[MAX_LINE_LENGTH];
+  unsigned long long cycle;
+  long code;
+  char *end;
+  size_t capacity = INITIAL_CAPACITY;
+  self->length = 0;
+  self->events = malloc(capacity * sizeof(KeyEvent));
+  FILE *file = fopen(path, "r");
+  if (file == NULL || self->events == NULL) {
+    perror(path);
+    free(self->events);
+    self->events = NULL;
+    if (file)
+      fclose(file);
+    return false;
+  }
+  bool ok = true;
+  for (size_t lineNumber = 1; ok && fgets(line, sizeof(line), file);
+       lineNumber++) {
+    char *c = line + strspn(line, " \t");
+    if (*c == '#' || *c == '\n' || *c == '\0')
+      continue;
+    bool valid = sscanf(c, "%llu %127s", &cycle, key) == 2 &&
+                 (!self->length ||
+                  cycle >= self->events[self->length - 1].cycle);
+    if (valid && (isdigit(*key) || (*key == '-' && key[1]))) {
+      errno = 0;
+      code = strtol(key, &end, 10);
+      valid = end != key && *end == '\0' && !errno && code >= 0 &&
+              code <= INT16_MAX;
+    } else if (valid) {
+      code = *key;
+      valid = !key[1] && isgraph(*key);
+    }
+    if (!valid) {
+      fprintf(stderr, "%s:%zu: Invalid key event\n", path, lineNumber);
+      ok = false;
+      break;
+    }
+    if (self->length == capacity) {
+      KeyEvent *grown = realloc(self->events, 2 * capacity * sizeof(KeyEvent));
+      if (grown == NULL) {
+        perror("Failed to allocate memory!");
+        ok = false;
+        break;
+      }
+      self->events = grown;
+      capacity *= 2;
+    }
+    self->events[self->length++] = (KeyEvent){cycle, (int16_t)code};
+  }
+  fclose(file);
+  if (!ok) {
+    free(self->events);
+    self->events = NULL;
+    self->length = 0;
+  }
+  return ok;
+}
+// machine_play {{{2
+void machine_play(Machine *self, uint64_t budget, KeyScript const *script,
+                  Captures *captures, Profile *profile) {
+  /* Runs like machine_run, pressing the keys of the script and capturing
+   * the screen on their cycle. Frames past the end of the run show the
+   * screen it ended with. */
+  size_t next = 0, frame = 0;
+  while (!self->halted && (!budget || self->cycles < budget)) {
+    while (script && next < script->length &&
+           script->events[next].cycle <= self->cycles)
+      self->ram[KEYBOARD_ADDRESS] = script->events[next++].key;
+    while (captures && frame < captures->length &&
+           captures->captures[frame].cycle <= self->cycles)
+      captures_take(captures, self, frame++);
+    uint64_t until = budget;
+    if (script && next < script->length &&
+        (!until || script->events[next].cycle < until))
+      until = script->events[next].cycle;
+    if (captures && frame < captures->length &&
+        (!until || captures->captures[frame].cycle < until))
+      until = captures->captures[frame].cycle;
+    machine_run(self, until, profile);
+  }
+  while (captures && frame < captures->length)
+    captures_take(captures, self, frame++);
+}
+// batch {{{1
+// declarations {{{2
+#define DEFAULT_BUDGET 100000000ULL
+
+typedef struct {
+  char name[MAX_LINE_LENGTH];
+  char rom[PATH_MAX];
+  char keys[PATH_MAX];
+  char frames[PATH_MAX];
+  char golden[PATH_MAX];
+  char snapshot[PATH_MAX];
+  uint64_t budget;
+  // Results
+  bool failed;
+  bool halted;
+  uint64_t cycles;
+  size_t mismatches;
+} Instance;
+typedef struct {
+  Instance *instances;
+  size_t length;
+  size_t next; // First instance no worker has taken yet
+  char const *dir;
+} Batch;
+// batch_load {{{2
+bool batch_load(Batch *self, char const *path, uint64_t budget) {
+  /* Reads a manifest of '<name> <file.hack> [keys=<script>]
+   * [cycles=<budget>] [frames=<cycles>] [golden=<frames>]
+   * [snapshot=<file>]' lines, '#' starts a comment */
+  char line[MAX_LINE_LENGTH * 4];
+  char option[PATH_MAX];
+  size_t capacity = INITIAL_CAPACITY;
+  self->length = 0;
+  self->next = 0;
+  self->instances = malloc(capacity * sizeof(Instance));
+  FILE *file = fopen(path, "r");
+  if (file == NULL || self->instances == NULL) {
+    perror(path);
+    free(self->instances);
+    if (file)
+      fclose(file);
+    return false;
+  }
+  bool ok = true;
+  for (size_t lineNumber = 1; fgets(line, sizeof(line), file); lineNumber++) {
+    char *c = line + strspn(line, " \t");
+    if (*c == '#' || *c == '\n' || *c == '\0')
+      continue;
+    if (self->length == capacity) {
+      Instance *grown =
+          realloc(self->instances, 2 * capacity * sizeof(Instance));
+      if (grown == NULL) {
+        perror("Failed to allocate memory!");
+        ok = false;
+        break;
+      }
+      self->instances = grown;
+      capacity *= 2;
+    }
+    Instance *instance = &self->instances[self->length];
+    *instance = (Instance){.budget = budget};
+    int length;
+    if (sscanf(c, "%127s %4095s%n", instance->name, instance->rom, &length) !=
+        2) {
+      fprintf(stderr, "%s:%zu: Invalid instance\n", path, lineNumber);
+      ok = false;
+      continue;
+    }
+    for (c += length; sscanf(c, " %4095s%n", option, &length) == 1;
+         c += length) {
+      if (!strncmp(option, "keys=", 5)) {
+        strcpy(instance->keys, option + 5);
+      } else if (!strncmp(option, "cycles=", 7)) {
+        instance->budget = strtoull(option + 7, NULL, 10);
+      } else if (!strncmp(option, "frames=", 7)) {
+        strcpy(instance->frames, option + 7);
+      } else if (!strncmp(option, "golden=", 7)) {
+        strcpy(instance->golden, option + 7);
+      } else if (!strncmp(option, "snapshot=", 9)) {
+        strcpy(instance->snapshot, option + 9);
+      } else {
+        fprintf(stderr, "%s:%zu: Unknown option %s\n", path, lineNumber,
+                option);
+        ok = false;
+      }
+    }
+    self->length++;
+  }
+  fclose(file);
+  return ok;
+}
+// batch_run_instance {{{2
+static void batch_run_instance(Instance *instance, Machine *machine,
+                               char const *dir) {
+  KeyScript script = {0};
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/%s", dir, instance->name);
+  Captures captures = {.prefix = (*instance->frames) ? path : NULL};
+  memset(machine, 0, sizeof(Machine));
+  instance->failed =
+      !machine_load(machine, instance->rom) ||
+      (*instance->snapshot && !snapshot_restore(machine, instance->snapshot)) ||
+      (*instance->keys && !key_script_load(&script, instance->keys)) ||
+      (*instance->frames && !captures_parse(&captures, instance->frames)) ||
+      (*instance->golden && !captures_load(&captures, instance->golden));
+  if (instance->failed) {
+    free(script.events);
+    free(captures.captures);
+    return;
+  }
+  machine_play(machine, instance->budget, (script.length) ? &script : NULL,
+               (captures.length) ? &captures : NULL, NULL);
+  free(script.events);
+  instance->halted = machine->halted;
+  instance->cycles = machine->cycles;
+  instance->mismatches = captures.mismatches;
+
+  // The hashes of the frames, in the format of golden files
+  if (captures.length) {
+    snprintf(path, sizeof(path), "%s/%s%s", dir, instance->name, FRAMES_EXT);
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+      perror(path);
+      instance->failed = true;
+    } else {
+      captures_write(&captures, file, NULL);
+      fclose(file);
+    }
+  }
+  free(captures.captures);
+
+  // The RAM image, screen included, in host byte order
+  snprintf(path, sizeof(path), "%s/%s%s", dir, instance->name, RAM_EXT);
+  FILE *file = fopen(path, "wb");
+  if (file == NULL || fwrite(machine->ram, sizeof(int16_t), RAM_SIZE, file) !=
+                          RAM_SIZE) {
+    perror(path);
+    instance->failed = true;
+  }
+  if (file)
+    fclose(file);
+}
+// batch_worker {{{2
+static void *batch_worker(void *arg) {
+  /* Takes the next instance until none are left, so long runs don't hold
+   * up the instances queued behind them */
+  Batch *batch = arg;
+  Machine *machine = machine_new();
+  if (machine == NULL)
+    return NULL;
+  for (size_t i; (i = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED)) <
+                 batch->length;)
+    batch_run_instance(&batch->instances[i], machine, batch->dir);
+  free(machine);
+  return NULL;
+}
+// batch_run {{{2
+int batch_run(char const *manifest, char const *dir, uint64_t budget,
+              long nThreads) {
+  /* Runs every instance of the manifest on a pool of threads and writes
+   * its RAM to <dir>/<name>.ram and its frames next to it, then lists the
+   * outcome of every instance in the order of the manifest */
+  Batch batch = {.dir = dir};
+  if (!batch_load(&batch, manifest, (budget) ? budget : DEFAULT_BUDGET)) {
+    free(batch.instances);
+    return EXIT_FAILURE;
+  }
+  if (nThreads < 1)
+    nThreads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (nThreads < 1)
+    nThreads = 1;
+  if ((size_t)nThreads > batch.length)
+    nThreads = (batch.length) ? batch.length : 1;
+  pthread_t *threads = malloc(nThreads * sizeof(pthread_t));
+  if (threads == NULL) {
+    perror("Failed to allocate memory!");
+    free(batch.instances);
+    return EXIT_FAILURE;
+  }
+  long started = 0;
+  for (; started < nThreads; started++) {
+    if (pthread_create(&threads[started], NULL, batch_worker, &batch))
+      break;
+  }
+  if (started == 0)
+    batch_worker(&batch);
+  for (long i = 0; i < started; i++)
+    pthread_join(threads[i], NULL);
+  free(threads);
+
+  int status = EXIT_SUCCESS;
+  for (size_t i = 0; i < batch.length; i++) {
+    Instance *instance = &batch.instances[i];
+    if (instance->failed || instance->mismatches)
+      status = EXIT_FAILURE;
+    printf("%s %s %llu\n", instance->name,
+           (instance->failed)       ? "error"
+           : (instance->mismatches) ? "mismatch"
+           : (instance->halted)     ? "halted"
+                                    : "stopped",
+           (unsigned long long)instance->cycles);
+  }
+  free(batch.instances);
+  return status;
+}
+// main {{{1
+int main(int argc, char *argv[]) {
+  uint64_t budget = 0;         // Cycle to stop on, 0 until the program halts
+  bool report = false;         // Print a profile of the run
+  char const *folded = NULL;   // Write the call paths of the run here
+  char const *keys = NULL;     // Script of key presses
+  char const *manifest = NULL; // Run the instances listed here instead
+  char const *dir = ".";       // Where batch runs write their RAM
+  long nThreads = 0;           // Threads of a batch run, 0 for every core
+  char const *frames = NULL;   // Cycles to capture the screen on
+  char const *golden = NULL;   // Frames to compare the screen with
+  char const *resume = NULL;   // Snapshot to continue from
+  char const *save = NULL;     // Snapshot the state the run ends with here
+  unsigned from = 0, to = 0;   // RAM words printed after the run
+  for (int opt; (opt = getopt(argc, argv, "n:pF:r:k:b:o:j:f:c:l:s:")) != -1;) {
+    switch (opt) {
+    case 'k':
+      keys = optarg;
+      break;
+    case 'b':
+      manifest = optarg;
+      break;
+    case 'o':
+      dir = optarg;
+      break;
+    case 'j':
+      nThreads = strtol(optarg, NULL, 10);
+      break;
+    case 'l':
+      resume = optarg;
+      break;
+    case 's':
+      save = optarg;
+      break;
+    case 'f':
+      frames = optarg;
+      break;
+    case 'c':
+      golden = optarg;
+      break;
+    case 'n':
+      budget = strtoull(optarg, NULL, 10);
+      break;
+    case 'p':
+      report = true;
+      break;
+    case 'F':
+      folded = optarg;
+      break;
+    case 'r':
+      if (sscanf(optarg, "%u:%u", &from, &to) != 2 || from > to ||
+          to > RAM_SIZE)
+        optind = argc;
+      break;
+    default:
+      optind = argc;
+    }
+  }
+  if (manifest && optind == argc)
+    return batch_run(manifest, dir, budget, nThreads);
+  if (manifest || optind != argc - 1) {
+    fprintf(stderr,
+            "Usage: %s [-n <cycles>] [-k <keys>] [-r <from>:<to>] [-p] "
+            "[-F <file>]\n"
+            "       %*s [-f <cycles>] [-c <frames>] [-l <snapshot>] "
+            "[-s <snapshot>] <file.hack>\n",
+            argv[0], (int)strlen(argv[0]), "");
+    fprintf(stderr, "       %s -b <manifest> [-n <cycles>] [-j <threads>] "
+                    "[-o <dir>]\n",
+            argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  Machine *machine = machine_new();
+  if (machine == NULL || !machine_load(machine, argv[optind]) ||
+      (resume && !snapshot_restore(machine, resume))) {
+    free(machine);
+    return EXIT_FAILURE;
+  }
+
+  // The symbol map and frames sit next to the ROM
+  char prefix[PATH_MAX];
+  char const *path = argv[optind];
+  char const *dot = strrchr(path, '.');
+  int length = (dot && !strchr(dot, '/')) ? dot - path : (int)strlen(path);
+  snprintf(prefix, sizeof(prefix), "%.*s", length, path);
+
+  Profile *profile = NULL;
+  if (report || folded) {
+    // Assembled with -g
+    char map_path[PATH_MAX];
+    if (snprintf(map_path, sizeof(map_path), "%s%s", prefix, SYMBOL_MAP_EXT) >=
+        (int)sizeof(map_path)) {
+      fprintf(stderr, "Path too long: %s%s\n", prefix, SYMBOL_MAP_EXT);
+      free(machine);
+      return EXIT_FAILURE;
+    }
+    profile = profile_new(map_path);
+    if (profile == NULL) {
+      fprintf(stderr, "Profiling needs the symbol map of assembler -g\n");
+      free(machine);
+      return EXIT_FAILURE;
+    }
+    // Only profile the cycles run after the snapshot
+    profile->since = profile->stack[0].start = machine->cycles;
+  }
+
+  Captures captures = {.prefix = (frames) ? prefix : NULL};
+  KeyScript script = {0};
+  if ((keys && !key_script_load(&script, keys)) ||
+      (frames && !captures_parse(&captures, frames)) ||
+      (golden && !captures_load(&captures, golden))) {
+    free(captures.captures);
+    free(script.events);
+    if (profile)
+      profile_del(profile);
+    free(machine);
+    return EXIT_FAILURE;
+  }
+  machine_play(machine, budget, (script.length) ? &script : NULL,
+               (captures.length) ? &captures : NULL, profile);
+  free(script.events);
+  fprintf(stderr, "%s after %llu cycles\n",
+          (machine->halted) ? "Halted" : "Stopped",
+          (unsigned long long)machine->cycles);
+  for (unsigned i = from; i < to; i++)
+    printf("%d%c", machine->ram[i], (i + 1 < to) ? ' ' : '\n');
+  captures_write(&captures, stdout, stderr);
+  free(captures.captures);
+  int status = (captures.mismatches) ? EXIT_FAILURE : EXIT_SUCCESS;
+  if (save && !snapshot_save(machine, save))
+    status = EXIT_FAILURE;
+
+  if (profile) {
+    profile_finish(profile, machine->cycles);
+    if (report)
+      profile_report(profile, machine->cycles - profile->stack[0].start,
+                     stdout);
+    if (folded)
+      profile_folded(profile, folded);
+    profile_del(profile);
+  }
+  free(machine);
+  return status;
+}
@@ -0,0 +1,3556 @@
+//
+// definitions {{{1
+#include <ctype.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <linux/limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_LINE_LENGTH 256
+#define MAX_TOKEN_LENGTH 64
+#define MAX_DIRS 32
+#define MAX_BUS_WIDTH 16
+#define MAX_LOWERED_INPUTS 3  // Bits of the chips lowered to gates
+#define MAX_LOWERED_OUTPUTS 4
+#define MAX_CELL_NETS (2 * MAX_BUS_WIDTH + 1)
+#define MAX_PROBE_DEPTH 2 // Of the parts test scripts can look into
+#define INITIAL_CAPACITY 16
+#define HDL_EXT ".hdl"
+
+#define NET_FALSE 0U
+#define NET_TRUE 1U
+#define NO_CELL UINT32_MAX
+#define NO_PROBE UINT32_MAX
+
+/* Every bit of a value is a lane simulating the chip for its own inputs,
+ * so gates are bitwise operations. Build with -DLANES=256 or 512 for the
+ * vector registers of AVX2 or AVX-512. */
+#ifndef LANES
+#define LANES 64
+#endif
+#if LANES == 64
+typedef uint64_t Value;
+#else
+typedef uint64_t Value __attribute__((vector_size(LANES / 8)));
+#endif
+typedef uint64_t LaneWord __attribute__((may_alias));
+#define ALL_LANES (~(Value){0})
+
+static inline bool lane_get(Value const *value, unsigned lane) {
+  return ((LaneWord const *)value)[lane / 64] >> (lane % 64) & 1;
+}
+static inline void lane_set(Value *value, unsigned lane, bool bit) {
+  LaneWord *word = &((LaneWord *)value)[lane / 64];
+  LaneWord mask = (LaneWord)1 << (lane % 64);
+  *word = (bit) ? *word | mask : *word & ~mask;
+}
+static inline bool value_differs(Value a, Value b) {
+  return memcmp(&a, &b, sizeof(Value)) != 0;
+}
+
+static bool grow(void *items, size_t *capacity, size_t length, size_t size) {
+  // Makes room for one more item in the array *items points to
+  if (length < *capacity)
+    return true;
+  size_t newCapacity = (*capacity) ? 2 * *capacity : INITIAL_CAPACITY;
+  void *grown = realloc(*(void **)items, newCapacity * size);
+  if (grown == NULL) {
+    perror("Failed to allocate memory!");
+    return false;
+  }
+  *(void **)items = grown;
+  *capacity = newCapacity;
+  return true;
+}
+// tokenizer {{{1
+// declarations {{{2
+typedef struct {
+  char const *path;
+  char *text;
+  char const *c;
+  size_t line;
+  char token[MAX_TOKEN_LENGTH]; // Empty at the end of the file
+  size_t tokenLine;
+} Lexer;
+// lex_next {{{2
+static void lex_next(Lexer *self) {
+  // Skips white space and comments, then reads a name, a number, '..' or a
+  // single symbol. Comments run to the end of the line after '//' or '--'.
+  char const *c = self->c;
+  for (;;) {
+    while (isspace((unsigned char)*c))
+      self->line += (*c++ == '\n');
+    if ((c[0] == '/' && c[1] == '/') || (c[0] == '-' && c[1] == '-')) {
+      c += strcspn(c, "\n");
+    } else if (c[0] == '/' && c[1] == '*') {
+      for (c += 2; *c && !(c[0] == '*' && c[1] == '/'); c++)
+        self->line += (*c == '\n');
+      c += (*c) ? 2 : 0;
+    } else
+      break;
+  }
+  self->tokenLine = self->line;
+  size_t length = 0;
+  if (isalnum((unsigned char)*c) || *c == '_') {
+    while (isalnum((unsigned char)*c) || *c == '_') {
+      if (length < MAX_TOKEN_LENGTH - 1)
+        self->token[length++] = *c;
+      c++;
+    }
+  } else if (c[0] == '.' && c[1] == '.') {
+    self->token[length++] = *c++;
+    self->token[length++] = *c++;
+  } else if (*c)
+    self->token[length++] = *c++;
+  self->token[length] = '\0';
+  self->c = c;
+}
+// lex_error {{{2
+static bool lex_error(Lexer const *self, char const *expected) {
+  fprintf(stderr, "%s:%zu: Expected %s, got '%s'\n", self->path,
+          self->tokenLine, expected, self->token);
+  return false;
+}
+// lex_expect {{{2
+static bool lex_expect(Lexer *self, char const *token) {
+  if (strcmp(self->token, token)) {
+    char expected[MAX_TOKEN_LENGTH + 2];
+    snprintf(expected, sizeof(expected), "'%s'", token);
+    return lex_error(self, expected);
+  }
+  lex_next(self);
+  return true;
+}
+// lex_name {{{2
+static bool lex_name(Lexer *self, char *name) {
+  if (!isalpha((unsigned char)*self->token) && *self->token != '_')
+    return lex_error(self, "a name");
+  strcpy(name, self->token);
+  lex_next(self);
+  return true;
+}
+// lex_number {{{2
+static bool lex_number(Lexer *self, int *number) {
+  if (!*self->token || strspn(self->token, "0123456789") != strlen(self->token))
+    return lex_error(self, "a number");
+  *number = atoi(self->token);
+  lex_next(self);
+  return true;
+}
+// chip definitions {{{1
+// declarations {{{2
+typedef enum {
+  NOT_BUILTIN,
+  NAND,
+  DFF,
+  ROM32K,
+  SCREEN,
+  KEYBOARD,
+  RAM, // Chips recognised as RAM with -M, not a chip of its own
+} Builtin;
+
+typedef struct {
+  char name[MAX_TOKEN_LENGTH];
+  unsigned width;
+  unsigned offset; // Of the first bit among the bits of all pins
+} Pin;
+typedef struct {
+  char pin[MAX_TOKEN_LENGTH];
+  int pinFrom, pinTo; // Bits connected, -1 for the whole pin
+  char signal[MAX_TOKEN_LENGTH];
+  int signalFrom, signalTo;
+} Connection;
+typedef struct {
+  uint8_t op;
+  uint8_t operands[3]; // Input bits of the chip
+} Gate;
+typedef struct ChipDef ChipDef;
+typedef struct Netlist Netlist;
+typedef struct {
+  char chip[MAX_TOKEN_LENGTH];
+  ChipDef *def; // Looked up when the chip is first flattened
+  Connection *connections;
+  size_t nConnections;
+  size_t line;
+} Part;
+struct ChipDef {
+  char name[MAX_TOKEN_LENGTH];
+  char path[PATH_MAX];
+  Pin *pins; // Inputs, then outputs
+  size_t nInputs;
+  size_t nOutputs;
+  unsigned nBits; // Of all pins
+  Part *parts;
+  size_t nParts;
+  Builtin builtin;
+  bool flattening; // Guards against chips made of themselves
+  int lowered;     // To one gate per output bit 1, not at all -1, untried 0
+  int ram;         // Address bits + 1 if a RAM, -1 if not, untried 0
+  Gate gates[MAX_LOWERED_OUTPUTS];
+  Netlist *flat; // Flattened alone, copied for its instances deep down
+};
+
+void netlist_del(Netlist *self);
+
+static Pin nandPins[] = {{"a", 1, 0}, {"b", 1, 1}, {"out", 1, 2}};
+static Pin dffPins[] = {{"in", 1, 0}, {"out", 1, 1}};
+static Pin romPins[] = {{"address", 15, 0}, {"out", 16, 15}};
+static Pin screenPins[] = {
+    {"in", 16, 0}, {"load", 1, 16}, {"address", 13, 17}, {"out", 16, 30}};
+static Pin keyboardPins[] = {{"out", 16, 0}};
+static ChipDef builtins[] = {
+    {.name = "Nand", .pins = nandPins, 2, 1, 3, .builtin = NAND},
+    {.name = "DFF", .pins = dffPins, 1, 1, 2, .builtin = DFF},
+    {.name = "ROM32K", .pins = romPins, 1, 1, 31, .builtin = ROM32K},
+    {.name = "Screen", .pins = screenPins, 3, 1, 46, .builtin = SCREEN},
+    {.name = "Keyboard", .pins = keyboardPins, 0, 1, 16, .builtin = KEYBOARD},
+};
+// chip_del {{{2
+void chip_del(ChipDef *self) {
+  if (self->flat)
+    netlist_del(self->flat);
+  for (size_t i = 0; i < self->nParts; i++)
+    free(self->parts[i].connections);
+  free(self->parts);
+  free(self->pins);
+  free(self);
+}
+// chip_pin {{{2
+Pin const *chip_pin(ChipDef const *self, char const *name) {
+  for (size_t i = 0; i < self->nInputs + self->nOutputs; i++) {
+    if (!strcmp(self->pins[i].name, name))
+      return &self->pins[i];
+  }
+  return NULL;
+}
+// parse_pins {{{2
+static bool parse_pins(ChipDef *self, Lexer *lex, size_t *count,
+                       size_t *capacity) {
+  // Reads 'name[width], ...;'
+  do {
+    if (!grow(&self->pins, capacity, self->nInputs + self->nOutputs,
+              sizeof(Pin)))
+      return false;
+    Pin *pin = &self->pins[self->nInputs + self->nOutputs];
+    int width = 1;
+    if (!lex_name(lex, pin->name))
+      return false;
+    if (!strcmp(lex->token, "[")) {
+      lex_next(lex);
+      if (!lex_number(lex, &width) || !lex_expect(lex, "]"))
+        return false;
+      if (width < 1 || width > MAX_BUS_WIDTH) {
+        fprintf(stderr, "%s:%zu: Invalid width of %s\n", lex->path,
+                lex->tokenLine, pin->name);
+        return false;
+      }
+    }
+    if (chip_pin(self, pin->name)) {
+      fprintf(stderr, "%s:%zu: Pin %s declared twice\n", lex->path,
+              lex->tokenLine, pin->name);
+      return false;
+    }
+    pin->width = width;
+    pin->offset = self->nBits;
+    self->nBits += width;
+    (*count)++;
+  } while (!strcmp(lex->token, ",") && (lex_next(lex), true));
+  return lex_expect(lex, ";");
+}
+// parse_range {{{2
+static bool parse_range(Lexer *lex, int *from, int *to) {
+  // Reads an optional '[i]' or '[i..j]'
+  *from = *to = -1;
+  if (strcmp(lex->token, "["))
+    return true;
+  lex_next(lex);
+  if (!lex_number(lex, from))
+    return false;
+  *to = *from;
+  if (!strcmp(lex->token, "..")) {
+    lex_next(lex);
+    if (!lex_number(lex, to))
+      return false;
+  }
+  if (*to < *from) {
+    fprintf(stderr, "%s:%zu: Invalid range\n", lex->path, lex->tokenLine);
+    return false;
+  }
+  return lex_expect(lex, "]");
+}
+// parse_part {{{2
+static bool parse_part(Part *self, Lexer *lex) {
+  // Reads 'Chip(pin=signal, ...);'
+  size_t capacity = 0;
+  self->line = lex->tokenLine;
+  if (!lex_name(lex, self->chip) || !lex_expect(lex, "("))
+    return false;
+  do {
+    if (!grow(&self->connections, &capacity, self->nConnections,
+              sizeof(Connection)))
+      return false;
+    Connection *connection = &self->connections[self->nConnections++];
+    if (!lex_name(lex, connection->pin) ||
+        !parse_range(lex, &connection->pinFrom, &connection->pinTo) ||
+        !lex_expect(lex, "=") || !lex_name(lex, connection->signal) ||
+        !parse_range(lex, &connection->signalFrom, &connection->signalTo))
+      return false;
+  } while (!strcmp(lex->token, ",") && (lex_next(lex), true));
+  return lex_expect(lex, ")") && lex_expect(lex, ";");
+}
+// chip_parse {{{2
+ChipDef *chip_parse(char const *path) {
+  /* Reads 'CHIP Name { IN pins; OUT pins; PARTS: parts }' from a file,
+   * either list of pins may be missing */
+  FILE *file = fopen(path, "r");
+  if (file == NULL)
+    return NULL;
+  ChipDef *self = calloc(1, sizeof(ChipDef));
+  char *text = NULL;
+  size_t size = 0;
+  if (self == NULL) {
+    perror("Failed to allocate memory!");
+    fclose(file);
+    return NULL;
+  }
+  for (size_t length = 0;; length += size / 2) {
+    size = (size) ? 2 * size : 4096;
+    char *grown = realloc(text, size + 1);
+    if (grown == NULL) {
+      perror("Failed to allocate memory!");
+      free(text);
+      fclose(file);
+      chip_del(self);
+      return NULL;
+    }
+    text = grown;
+    size_t n = fread(text + length, 1, size - length, file);
+    if (length + n < size) {
+      text[length + n] = '\0';
+      break;
+    }
+  }
+  fclose(file);
+  strcpy(self->path, path);
+
+  Lexer lex = {.path = path, .text = text, .c = text, .line = 1};
+  size_t pinCapacity = 0, partCapacity = 0;
+  lex_next(&lex);
+  bool ok = lex_expect(&lex, "CHIP") && lex_name(&lex, self->name) &&
+            lex_expect(&lex, "{");
+  if (ok && !strcmp(lex.token, "IN")) {
+    lex_next(&lex);
+    ok = parse_pins(self, &lex, &self->nInputs, &pinCapacity);
+  }
+  if (ok && !strcmp(lex.token, "OUT")) {
+    lex_next(&lex);
+    ok = parse_pins(self, &lex, &self->nOutputs, &pinCapacity);
+  }
+  if (ok && !strcmp(lex.token, "BUILTIN")) {
+    fprintf(stderr, "%s: Built-in chip %s has no implementation here\n", path,
+            self->name);
+    ok = false;
+  }
+  ok = ok && lex_expect(&lex, "PARTS") && lex_expect(&lex, ":");
+  while (ok && strcmp(lex.token, "}")) {
+    if (!*lex.token) {
+      ok = lex_error(&lex, "'}'");
+    } else if ((ok = grow(&self->parts, &partCapacity, self->nParts,
+                          sizeof(Part)))) {
+      Part *part = &self->parts[self->nParts++];
+      *part = (Part){0};
+      ok = parse_part(part, &lex);
+    }
+  }
+  free(text);
+  if (!ok) {
+    chip_del(self);
+    return NULL;
+  }
+  return self;
+}
+// library {{{1
+// declarations {{{2
+typedef struct {
+  ChipDef **chips;
+  size_t length;
+  size_t capacity;
+  char home[PATH_MAX]; // Of the chip simulated, searched first
+  char const *dirs[MAX_DIRS]; // Searched in order for <Chip>.hdl
+  size_t nDirs;
+} Library;
+// library_del {{{2
+void library_del(Library *self) {
+  for (size_t i = 0; i < self->length; i++)
+    chip_del(self->chips[i]);
+  free(self->chips);
+}
+// library_find {{{2
+ChipDef *library_find(Library *self, char const *name) {
+  /* Returns a chip already read, a built-in one or the first <name>.hdl of
+   * the search directories. The registers of the CPU are plain ones. */
+  if (!strcmp(name, "ARegister") || !strcmp(name, "DRegister"))
+    name = "Register";
+  for (size_t i = 0; i < self->length; i++) {
+    if (!strcmp(self->chips[i]->name, name))
+      return self->chips[i];
+  }
+  for (size_t i = 0; i < sizeof(builtins) / sizeof(*builtins); i++) {
+    if (!strcmp(builtins[i].name, name))
+      return &builtins[i];
+  }
+  char path[PATH_MAX];
+  for (size_t i = 0; i <= self->nDirs; i++) {
+    char const *dir = (i) ? self->dirs[i - 1] : self->home;
+    if (snprintf(path, sizeof(path), "%s/%s%s", dir, name, HDL_EXT) >=
+        (int)sizeof(path)) {
+      fprintf(stderr, "Path too long: %s/%s%s\n", dir, name, HDL_EXT);
+      return NULL;
+    }
+    if (access(path, R_OK))
+      continue;
+    ChipDef *chip = chip_parse(path);
+    if (chip == NULL)
+      return NULL;
+    if (strcmp(chip->name, name)) {
+      fprintf(stderr, "%s: Defines %s instead of %s\n", path, chip->name,
+              name);
+      chip_del(chip);
+      return NULL;
+    }
+    if (!grow(&self->chips, &self->capacity, self->length,
+              sizeof(ChipDef *))) {
+      chip_del(chip);
+      return NULL;
+    }
+    self->chips[self->length++] = chip;
+    return chip;
+  }
+  fprintf(stderr, "Chip %s not found\n", name);
+  return NULL;
+}
+// library_load {{{2
+ChipDef *library_load(Library *self, char const *path) {
+  // Reads the chip to simulate, whose parts are looked up next to it first
+  char const *slash = strrchr(path, '/');
+  snprintf(self->home, sizeof(self->home), "%.*s",
+           (slash) ? (int)(slash - path) : 1, (slash) ? path : ".");
+  ChipDef *chip = chip_parse(path);
+  if (chip == NULL) {
+    if (access(path, R_OK))
+      perror(path);
+    return NULL;
+  }
+  if (!grow(&self->chips, &self->capacity, self->length, sizeof(ChipDef *))) {
+    chip_del(chip);
+    return NULL;
+  }
+  self->chips[self->length++] = chip;
+  return chip;
+}
+// netlist {{{1
+// declarations {{{2
+typedef enum {
+  OP_NAND,
+  // Gates small chips are lowered to with -O
+  OP_NOT,
+  OP_AND,
+  OP_OR,
+  OP_XOR,
+  OP_NOR,
+  OP_XNOR,
+  OP_ANDN, // a and not b
+  OP_MUX,  // c selects b over a
+  OP_XOR3,
+  OP_MAJ,    // Carry of a full adder
+  OP_ADD,    // Only in words, c is the carry in
+  OP_WORD,   // Applies the same gate to every bit of the word at index a
+  OP_MEMORY, // Reads the memory at index a
+} Op;
+
+typedef struct {
+  uint32_t op;
+  uint32_t a;
+  uint32_t b;
+  uint32_t c;
+  uint32_t out;
+  uint32_t level; // Longest path from an input or flip-flop, in cells
+  uint32_t part;  // Probe of the part near the top it comes from
+} Cell;
+typedef struct {
+  Op op;
+  unsigned width;
+  uint32_t a[MAX_BUS_WIDTH];
+  uint32_t b[MAX_BUS_WIDTH];
+  uint32_t out[MAX_BUS_WIDTH];
+  uint32_t c;     // Shared by every bit: the select or the carry in
+  uint32_t carry; // Out of an adder
+} Word;
+typedef struct {
+  uint32_t in;
+  uint32_t out;
+  uint32_t part;
+} Flop;
+enum {
+  MARK_SCHEDULED = 1, // Cell queued or flip-flop with a changed input
+  MARK_SAMPLED = 2,   // Flip-flop whose input the tick took
+};
+typedef struct {
+  Builtin kind;
+  char const *name; // Of the chip
+  uint32_t cell;    // Reading it, once the events are set up
+  unsigned width; // Of the address
+  uint32_t address[MAX_BUS_WIDTH];
+  uint32_t in[MAX_BUS_WIDTH];
+  uint32_t load;
+  uint32_t out[MAX_BUS_WIDTH];
+  uint16_t *words;   // Of every lane in turn
+  size_t stride;     // Between the words of two lanes, 0 for the ROM
+  bool write[LANES]; // Lanes writing when the clock falls
+  uint16_t writeAddress[LANES];
+  uint16_t writeValue[LANES];
+} Memory;
+typedef struct {
+  char const *name; // Of the chip of a part, like PC, or of an internal pin
+  uint32_t parent;  // Probe of the part it is in
+  unsigned width;   // Of its out pin, 0 without one
+  uint32_t out[MAX_BUS_WIDTH];
+} Probe;
+struct Netlist {
+  ChipDef *chip;
+  uint32_t *pins; // Net of every bit of the pins of the chip
+  size_t nNets;
+  Cell *cells; // Sorted by level
+  size_t nCells;
+  Flop *flops;
+  size_t nFlops;
+  Memory *memories;
+  size_t nMemories;
+  Word *words;
+  size_t nWords;
+  Probe *probes; // Outputs of the parts near the top
+  size_t nProbes;
+  Probe *wires; // Internal pins of the chip
+  size_t nWires;
+  size_t nLevels;
+  unsigned lanes; // In use, memories only look at these
+  Value *values;  // Of every net
+  Value *state;   // Of every flip-flop
+  // Event driven, once netlist_events set it up
+  bool events;
+  uint32_t *fanout;      // Cells, then flip-flops after nCells, of every net
+  uint32_t *fanoutStart; // Of every net in fanout, and the end
+  uint32_t *levelStart;  // Of every level in cells, and the end
+  uint32_t *queued;      // Cells scheduled in every level
+  uint32_t *queue;       // Scheduled cells, at the start of their level
+  uint8_t *marks;        // Of every cell and flip-flop
+  uint32_t *dirty;       // Flip-flops whose input changed since the tick
+  size_t nDirty;
+  uint32_t *sampled; // Flip-flops the tick took a new input of
+  size_t nSampled;
+  // Compiled, once netlist_compile loaded it
+  void *compiled;
+  void (*compiledEval)(Value *, void *, void (*)(void *, unsigned, Value *));
+  void (*compiledTick)(Value const *, Value *);
+  void (*compiledTock)(Value *, Value const *);
+  // While flattening
+  Library *library;
+  bool optimize;    // Lower small chips to gates and buses to words
+  bool rams;        // Simulate chips made of registers as arrays
+  uint32_t *parent; // Nets connected together share a root
+  uint8_t *driven;  // Whether anything drives the root
+  size_t netCapacity;
+  size_t cellCapacity;
+  size_t flopCapacity;
+  size_t memoryCapacity;
+  size_t wordCapacity;
+  size_t probeCapacity;
+  size_t wireCapacity;
+  unsigned depth; // Of the chip being flattened
+  uint32_t part;  // Probe of the part being flattened
+};
+
+Netlist *netlist_new(Library *library, ChipDef *chip, bool optimize,
+                     bool rams);
+void netlist_eval(Netlist *self);
+int netlist_probe(Netlist const *self, Probe const *probe, unsigned lane);
+bool netlist_compile(Netlist *self);
+// values_new {{{2
+static Value *values_new(size_t length) {
+  // Cleared and aligned for the vector registers, unlike calloc
+  Value *self = aligned_alloc(sizeof(Value), length * sizeof(Value));
+  if (self)
+    memset(self, 0, length * sizeof(Value));
+  return self;
+}
+// netlist_del {{{2
+void netlist_del(Netlist *self) {
+  if (self->compiled)
+    dlclose(self->compiled);
+  for (size_t i = 0; i < self->nMemories; i++)
+    free(self->memories[i].words);
+  free(self->memories);
+  free(self->words);
+  free(self->probes);
+  free(self->wires);
+  free(self->fanout);
+  free(self->fanoutStart);
+  free(self->levelStart);
+  free(self->queued);
+  free(self->queue);
+  free(self->marks);
+  free(self->dirty);
+  free(self->sampled);
+  free(self->pins);
+  free(self->cells);
+  free(self->flops);
+  free(self->values);
+  free(self->state);
+  free(self->parent);
+  free(self->driven);
+  free(self);
+}
+// net_new {{{2
+static uint32_t net_new(Netlist *self, bool driven) {
+  size_t capacity = self->netCapacity;
+  if (!grow(&self->parent, &self->netCapacity, self->nNets, sizeof(uint32_t)))
+    return NET_FALSE;
+  if (capacity != self->netCapacity) {
+    uint8_t *grown = realloc(self->driven, self->netCapacity);
+    if (grown == NULL) {
+      perror("Failed to allocate memory!");
+      return NET_FALSE;
+    }
+    self->driven = grown;
+  }
+  self->parent[self->nNets] = self->nNets;
+  self->driven[self->nNets] = driven;
+  return self->nNets++;
+}
+// net_find {{{2
+static uint32_t net_find(Netlist *self, uint32_t net) {
+  while (self->parent[net] != net) {
+    self->parent[net] = self->parent[self->parent[net]];
+    net = self->parent[net];
+  }
+  return net;
+}
+// net_join {{{2
+static bool net_join(Netlist *self, uint32_t a, uint32_t b) {
+  // Connects two nets, of which at most one may have a driver
+  a = net_find(self, a);
+  b = net_find(self, b);
+  if (a == b)
+    return true;
+  if (self->driven[a] && self->driven[b])
+    return false;
+  if (a < b) {
+    uint32_t t = a;
+    a = b;
+    b = t;
+  }
+  // Constants stay the roots of their nets
+  self->parent[a] = b;
+  self->driven[b] |= self->driven[a];
+  return true;
+}
+// net_drive {{{2
+static bool net_drive(Netlist *self, uint32_t net) {
+  net = net_find(self, net);
+  if (self->driven[net])
+    return false;
+  self->driven[net] = true;
+  return true;
+}
+// cell_inputs {{{2
+static unsigned cell_inputs(Netlist const *self, Cell const *cell,
+                            uint32_t *nets) {
+  // Stores the nets a cell reads and returns their count
+  if (cell->op == OP_MEMORY) {
+    memcpy(nets, self->memories[cell->a].address,
+           MAX_BUS_WIDTH * sizeof(uint32_t));
+    return self->memories[cell->a].width;
+  }
+  if (cell->op == OP_WORD) {
+    Word const *word = &self->words[cell->a];
+    memcpy(nets, word->a, word->width * sizeof(uint32_t));
+    memcpy(nets + word->width, word->b, word->width * sizeof(uint32_t));
+    nets[2 * word->width] = word->c;
+    return 2 * word->width + 1;
+  }
+  nets[0] = cell->a;
+  nets[1] = cell->b;
+  nets[2] = cell->c;
+  return (cell->op == OP_NOT) ? 1 : (cell->op >= OP_MUX) ? 3 : 2;
+}
+// cell_outputs {{{2
+static unsigned cell_outputs(Netlist const *self, Cell const *cell,
+                             uint32_t *nets) {
+  if (cell->op == OP_MEMORY) {
+    memcpy(nets, self->memories[cell->a].out,
+           MAX_BUS_WIDTH * sizeof(uint32_t));
+    return MAX_BUS_WIDTH;
+  }
+  if (cell->op == OP_WORD) {
+    Word const *word = &self->words[cell->a];
+    memcpy(nets, word->out, word->width * sizeof(uint32_t));
+    nets[word->width] = word->carry;
+    return word->width + (word->op == OP_ADD);
+  }
+  nets[0] = cell->out;
+  return 1;
+}
+// flatten_memory {{{2
+static bool flatten_memory(Netlist *self, ChipDef const *chip,
+                           Builtin kind, uint32_t const *nets) {
+  if (!grow(&self->memories, &self->memoryCapacity, self->nMemories,
+            sizeof(Memory)) ||
+      !grow(&self->cells, &self->cellCapacity, self->nCells, sizeof(Cell)))
+    return false;
+  Memory *memory = &self->memories[self->nMemories];
+  *memory = (Memory){.kind = kind, .name = chip->name, .load = NET_FALSE};
+  Pin const *address = chip_pin(chip, "address");
+  Pin const *in = chip_pin(chip, "in");
+  Pin const *load = chip_pin(chip, "load");
+  Pin const *out = chip_pin(chip, "out");
+  if (address) {
+    memory->width = address->width;
+    memcpy(memory->address, nets + address->offset,
+           address->width * sizeof(uint32_t));
+  }
+  if (in && load) {
+    memcpy(memory->in, nets + in->offset, in->width * sizeof(uint32_t));
+    memory->load = nets[load->offset];
+  }
+  // The program is the same for every lane
+  memory->stride = (kind == ROM32K) ? 0 : (size_t)1 << memory->width;
+  memory->words = calloc((memory->stride) ? LANES * memory->stride
+                                          : (size_t)1 << memory->width,
+                         sizeof(uint16_t));
+  if (memory->words == NULL) {
+    perror("Failed to allocate memory!");
+    return false;
+  }
+  self->cells[self->nCells++] =
+      (Cell){OP_MEMORY, self->nMemories++, 0, 0, NET_FALSE, 0, self->part};
+  for (unsigned i = 0; i < out->width; i++) {
+    memory->out[i] = nets[out->offset + i];
+    if (!net_drive(self, memory->out[i]))
+      return false;
+  }
+  return true;
+}
+// flatten_builtin {{{2
+static bool flatten_builtin(Netlist *self, ChipDef const *chip,
+                            uint32_t const *nets) {
+  bool ok = true;
+  switch (chip->builtin) {
+  case NAND:
+    if (!grow(&self->cells, &self->cellCapacity, self->nCells, sizeof(Cell)))
+      return false;
+    self->cells[self->nCells++] =
+        (Cell){OP_NAND, nets[0], nets[1], NET_FALSE, nets[2], 0, self->part};
+    ok = net_drive(self, nets[2]);
+    break;
+  case DFF:
+    if (!grow(&self->flops, &self->flopCapacity, self->nFlops, sizeof(Flop)))
+      return false;
+    self->flops[self->nFlops++] = (Flop){nets[0], nets[1], self->part};
+    ok = net_drive(self, nets[1]);
+    break;
+  default:
+    ok = flatten_memory(self, chip, chip->builtin, nets);
+  }
+  if (!ok)
+    fprintf(stderr, "%s: Output connected to a pin with a driver\n",
+            chip->name);
+  return ok;
+}
+// flatten_lowered {{{2
+static bool flatten_lowered(Netlist *self, ChipDef const *chip,
+                            uint32_t const *nets) {
+  unsigned nInputBits = chip->pins[chip->nInputs].offset;
+  for (unsigned bit = nInputBits; bit < chip->nBits; bit++) {
+    if (!grow(&self->cells, &self->cellCapacity, self->nCells, sizeof(Cell)))
+      return false;
+    Gate const *gate = &chip->gates[bit - nInputBits];
+    uint32_t operands[3];
+    for (unsigned i = 0; i < 3; i++)
+      operands[i] = (gate->operands[i] == UINT8_MAX)
+                        ? NET_FALSE
+                        : nets[gate->operands[i]];
+    self->cells[self->nCells++] =
+        (Cell){gate->op, operands[0], operands[1], operands[2], nets[bit], 0,
+               self->part};
+    if (!net_drive(self, nets[bit])) {
+      fprintf(stderr, "%s: Output connected to a pin with a driver\n",
+              chip->name);
+      return false;
+    }
+  }
+  return true;
+}
+// chip_lower {{{2
+static struct {
+  Op op;
+  unsigned arity;
+  uint8_t table; // Output for the inputs a + 2b + 4c
+} const gateTables[] = {
+    {OP_NOT, 1, 0x01},  {OP_AND, 2, 0x08},  {OP_OR, 2, 0x0e},
+    {OP_XOR, 2, 0x06},  {OP_NAND, 2, 0x07}, {OP_NOR, 2, 0x01},
+    {OP_XNOR, 2, 0x09}, {OP_ANDN, 2, 0x02}, {OP_MUX, 3, 0xca},
+    {OP_XOR3, 3, 0x96}, {OP_MAJ, 3, 0xe8},
+};
+
+static bool gate_match(size_t gate, unsigned nInputs, unsigned table,
+                       Gate *match) {
+  // Tries the gate on every choice of the inputs of a chip for its operands
+  unsigned arity = gateTables[gate].arity;
+  for (unsigned x = 0; x < nInputs; x++) {
+    for (unsigned y = 0; y < ((arity > 1) ? nInputs : 1); y++) {
+      for (unsigned z = 0; z < ((arity > 2) ? nInputs : 1); z++) {
+        if ((arity > 1 && y == x) || (arity > 2 && (z == x || z == y)))
+          continue;
+        unsigned expected = 0;
+        for (unsigned inputs = 0; inputs < (1U << nInputs); inputs++) {
+          unsigned index = (inputs >> x & 1) | (inputs >> y & 1) << 1 |
+                           (inputs >> z & 1) << 2;
+          if (arity < 3)
+            index &= (1U << arity) - 1;
+          expected |= (gateTables[gate].table >> index & 1U) << inputs;
+        }
+        if (expected == table) {
+          *match = (Gate){gateTables[gate].op,
+                          {x, (arity > 1) ? y : UINT8_MAX,
+                           (arity > 2) ? z : UINT8_MAX}};
+          return true;
+        }
+      }
+    }
+  }
+  return false;
+}
+
+static bool chip_lower(Netlist *self, ChipDef *chip) {
+  /* Finds a gate for every output bit of a small combinational chip by
+   * simulating it for all its inputs at once, a lane per combination. Fails
+   * on errors in the chip only. */
+  unsigned nInputBits = (chip->nOutputs) ? chip->pins[chip->nInputs].offset
+                                         : chip->nBits;
+  unsigned nOutputBits = chip->nBits - nInputBits;
+  chip->lowered = -1;
+  if (nInputBits == 0 || nInputBits > MAX_LOWERED_INPUTS ||
+      nOutputBits == 0 || nOutputBits > MAX_LOWERED_OUTPUTS)
+    return true;
+  Netlist *netlist = netlist_new(self->library, chip, true, false);
+  if (netlist == NULL)
+    return false;
+  if (netlist->nFlops || netlist->nMemories) {
+    netlist_del(netlist);
+    return true;
+  }
+  for (unsigned bit = 0; bit < nInputBits; bit++) {
+    for (unsigned lane = 0; lane < (1U << nInputBits); lane++)
+      lane_set(&netlist->values[netlist->pins[bit]], lane, lane >> bit & 1);
+  }
+  netlist_eval(netlist);
+  bool lowered = true;
+  for (unsigned bit = 0; lowered && bit < nOutputBits; bit++) {
+    unsigned table = 0;
+    for (unsigned lane = 0; lane < (1U << nInputBits); lane++)
+      table |= (unsigned)lane_get(
+                   &netlist->values[netlist->pins[nInputBits + bit]], lane)
+               << lane;
+    lowered = false;
+    for (size_t gate = 0; !lowered && gate < sizeof(gateTables) /
+                                                 sizeof(*gateTables);
+         gate++)
+      lowered = gate_match(gate, nInputBits, table, &chip->gates[bit]);
+  }
+  netlist_del(netlist);
+  chip->lowered = (lowered) ? 1 : -1;
+  return true;
+}
+// group_word {{{2
+static bool group_word(Netlist *self, size_t start, uint32_t const *pins,
+                       unsigned nPins) {
+  /* Replaces the cells a chip just added by a word when they are the same
+   * gate on independent bits, like And16 or Mux16 with a shared select,
+   * or a ripple of full adders like Add16 */
+  size_t n = self->nCells - start;
+  Cell *cells = self->cells + start;
+  if (n < 2 || n > 2 * MAX_BUS_WIDTH)
+    return true;
+  uint32_t outs[2 * MAX_BUS_WIDTH];
+  for (size_t i = 0; i < n; i++) {
+    if (cells[i].op == OP_WORD || cells[i].op == OP_MEMORY)
+      return true;
+    outs[i] = net_find(self, cells[i].out);
+  }
+  Word word = {.op = cells[0].op, .c = NET_FALSE, .carry = NET_FALSE};
+  if (cells[0].op == OP_XOR3 || cells[0].op == OP_MAJ) {
+    // Pair the sum and carry of every bit, then follow the carries
+    size_t sums[MAX_BUS_WIDTH], carries[MAX_BUS_WIDTH];
+    size_t width = 0;
+    bool taken[2 * MAX_BUS_WIDTH] = {false};
+    for (size_t i = 0; i < n; i++) {
+      if (cells[i].op != OP_XOR3 && cells[i].op != OP_MAJ)
+        return true;
+      if (cells[i].op == OP_MAJ)
+        continue;
+      uint32_t x = net_find(self, cells[i].a), y = net_find(self, cells[i].b),
+               z = net_find(self, cells[i].c);
+      for (size_t j = 0; j < n; j++) {
+        if (cells[j].op != OP_MAJ || taken[j])
+          continue;
+        uint32_t p = net_find(self, cells[j].a),
+                 q = net_find(self, cells[j].b),
+                 r = net_find(self, cells[j].c);
+        if ((x == p || x == q || x == r) && (y == p || y == q || y == r) &&
+            (z == p || z == q || z == r) && (p == x || p == y || p == z) &&
+            (q == x || q == y || q == z) && (r == x || r == y || r == z)) {
+          taken[j] = true;
+          sums[width] = i;
+          carries[width++] = j;
+          break;
+        }
+      }
+    }
+    if (2 * width != n || width > MAX_BUS_WIDTH)
+      return true;
+    // Order the bits by following the carries, from the bit that takes none
+    uint32_t carry = NET_FALSE;
+    for (size_t bit = 0; bit < width; bit++) {
+      size_t found = width;
+      unsigned in = 2;
+      for (size_t i = bit; found == width && i < width; i++) {
+        Cell const *sum = &cells[sums[i]];
+        uint32_t operands[3] = {sum->a, sum->b, sum->c};
+        unsigned chained = 0, other = 0;
+        for (unsigned k = 0; k < 3; k++) {
+          uint32_t root = net_find(self, operands[k]);
+          for (size_t j = 0; j < width; j++) {
+            other += root == outs[sums[j]];
+            if (root != outs[carries[j]])
+              continue;
+            if (bit && root == carry)
+              chained++, in = k;
+            else
+              other++;
+          }
+        }
+        if (other == 0 && chained == (bit != 0))
+          found = i;
+      }
+      if (found == width)
+        return true;
+      size_t t = sums[bit];
+      sums[bit] = sums[found];
+      sums[found] = t;
+      t = carries[bit];
+      carries[bit] = carries[found];
+      carries[found] = t;
+      Cell const *sum = &cells[sums[bit]];
+      uint32_t operands[3] = {sum->a, sum->b, sum->c};
+      if (bit == 0)
+        word.c = operands[in];
+      word.a[bit] = operands[(in == 0) ? 1 : 0];
+      word.b[bit] = operands[(in == 2) ? 1 : 2];
+      word.out[bit] = sum->out;
+      carry = outs[carries[bit]];
+    }
+    // The carries between the bits must stay inside
+    for (size_t bit = 0; bit + 1 < width; bit++) {
+      for (unsigned i = 0; i < nPins; i++) {
+        if (net_find(self, pins[i]) == outs[carries[bit]])
+          return true;
+      }
+    }
+    word.op = OP_ADD;
+    word.width = width;
+    word.carry = cells[carries[width - 1]].out;
+  } else {
+    if (n > MAX_BUS_WIDTH)
+      return true;
+    uint32_t select = net_find(self, cells[0].c);
+    for (size_t i = 0; i < n; i++) {
+      if (cells[i].op != word.op ||
+          (word.op == OP_MUX && net_find(self, cells[i].c) != select))
+        return true;
+      // No bit may read another
+      uint32_t operands[3] = {net_find(self, cells[i].a),
+                              net_find(self, cells[i].b),
+                              net_find(self, cells[i].c)};
+      for (size_t j = 0; j < n; j++) {
+        for (unsigned k = 0; k < 3; k++) {
+          if (operands[k] == outs[j])
+            return true;
+        }
+      }
+      word.a[i] = cells[i].a;
+      word.b[i] = cells[i].b;
+      word.out[i] = cells[i].out;
+    }
+    word.width = n;
+    word.c = cells[0].c;
+  }
+  if (!grow(&self->words, &self->wordCapacity, self->nWords, sizeof(Word)))
+    return false;
+  self->words[self->nWords] = word;
+  *cells = (Cell){OP_WORD, self->nWords++, 0, 0, NET_FALSE, 0, cells->part};
+  self->nCells = start + 1;
+  return true;
+}
+// chip_ram {{{2
+static Connection const *part_connection(Part const *self, char const *pin) {
+  for (size_t i = 0; i < self->nConnections; i++) {
+    if (!strcmp(self->connections[i].pin, pin))
+      return &self->connections[i];
+  }
+  return NULL;
+}
+
+static bool connection_is(Connection const *self, char const *signal,
+                          int from, int to, unsigned width) {
+  // Whether the whole pin connects to bits from..to of a signal so wide
+  if (self == NULL || self->pinFrom >= 0 || strcmp(self->signal, signal))
+    return false;
+  if (self->signalFrom < 0)
+    return from == 0 && to == (int)width - 1;
+  return self->signalFrom == from && self->signalTo == to;
+}
+
+static int chip_ram(Netlist *self, ChipDef *chip) {
+  /* Recognises the RAM chips of the book: a DMux8Way or DMux4Way giving the
+   * load to one of registers or smaller RAM chips by the high bits of the
+   * address, whose outputs a Mux8Way16 or Mux4Way16 selects the same way.
+   * Returns the bits of the address, 0 for a register, -1 if not a RAM.
+   * Registers and multiplexers are trusted to work as their names say. */
+  if (chip->builtin)
+    return -1;
+  if (chip->ram)
+    return (chip->ram < 0) ? -1 : chip->ram - 1;
+  chip->ram = -1;
+  Pin const *in = chip_pin(chip, "in");
+  Pin const *load = chip_pin(chip, "load");
+  Pin const *address = chip_pin(chip, "address");
+  Pin const *out = chip_pin(chip, "out");
+  if (!in || in->width != MAX_BUS_WIDTH || !load || load->width != 1 ||
+      !out || out->width != MAX_BUS_WIDTH || chip->nOutputs != 1 ||
+      chip->nInputs != 2U + (address != NULL))
+    return -1;
+  if (address == NULL) {
+    if (!strcmp(chip->name, "Register"))
+      chip->ram = 1;
+    return chip->ram - 1;
+  }
+
+  Part *dmux = NULL, *mux = NULL;
+  for (size_t i = 0; i < chip->nParts; i++) {
+    Part *part = &chip->parts[i];
+    if (!strncmp(part->chip, "DMux", 4) &&
+        connection_is(part_connection(part, "in"), "load", 0, 0, 1))
+      dmux = part;
+    else if (!strncmp(part->chip, "Mux", 3) &&
+             connection_is(part_connection(part, "out"), "out", 0,
+                           MAX_BUS_WIDTH - 1, MAX_BUS_WIDTH))
+      mux = part;
+  }
+  if (!dmux || !mux ||
+      (!dmux->def && !(dmux->def = library_find(self->library, dmux->chip))) ||
+      (!mux->def && !(mux->def = library_find(self->library, mux->chip))))
+    return -1;
+  size_t ways = dmux->def->nOutputs;
+  unsigned selBits = 0;
+  while ((1U << selBits) < ways)
+    selBits++;
+  if (ways < 2 || ways > 8 || (1U << selBits) != ways ||
+      selBits > address->width || chip->nParts != ways + 2 ||
+      dmux->nConnections != ways + 2 || mux->nConnections != ways + 2 ||
+      mux->def->nInputs != ways + 1)
+    return -1;
+  int low = address->width - selBits;
+  if (!connection_is(part_connection(dmux, "sel"), "address", low,
+                     address->width - 1, address->width) ||
+      !connection_is(part_connection(mux, "sel"), "address", low,
+                     address->width - 1, address->width))
+    return -1;
+
+  // Every way is a smaller RAM, loaded by the demultiplexer
+  bool used[2 + 8] = {false};
+  for (size_t way = 0; way < ways; way++) {
+    Connection const *loads = part_connection(
+        dmux, dmux->def->pins[dmux->def->nInputs + way].name);
+    Connection const *outs = part_connection(mux, mux->def->pins[way].name);
+    if (!loads || !outs || loads->pinFrom >= 0 || loads->signalFrom >= 0 ||
+        outs->pinFrom >= 0 || outs->signalFrom >= 0 ||
+        chip_pin(chip, loads->signal) || chip_pin(chip, outs->signal))
+      return -1;
+    size_t found = chip->nParts;
+    for (size_t i = 0; found == chip->nParts && i < chip->nParts; i++) {
+      Part *part = &chip->parts[i];
+      if (part == dmux || part == mux || used[i] ||
+          part->nConnections != 3U + (low > 0) ||
+          !connection_is(part_connection(part, "load"), loads->signal, 0, 0,
+                         1) ||
+          !connection_is(part_connection(part, "out"), outs->signal, 0,
+                         MAX_BUS_WIDTH - 1, MAX_BUS_WIDTH) ||
+          !connection_is(part_connection(part, "in"), "in", 0,
+                         MAX_BUS_WIDTH - 1, MAX_BUS_WIDTH) ||
+          (low > 0 && !connection_is(part_connection(part, "address"),
+                                     "address", 0, low - 1, address->width)))
+        continue;
+      if (!part->def && !(part->def = library_find(self->library, part->chip)))
+        return -1;
+      if (chip_ram(self, part->def) == low)
+        found = i;
+    }
+    if (found == chip->nParts)
+      return -1;
+    used[found] = true;
+  }
+  chip->ram = address->width + 1;
+  return address->width;
+}
+// flatten {{{2
+typedef struct {
+  char const *name;
+  uint32_t *nets;
+  unsigned width;
+  bool own; // Allocated for an internal pin
+} Signal;
+
+static Signal *scope_find(Signal *scope, size_t length, char const *name) {
+  for (size_t i = 0; i < length; i++) {
+    if (!strcmp(scope[i].name, name))
+      return &scope[i];
+  }
+  return NULL;
+}
+
+static bool flatten(Netlist *self, ChipDef *chip, uint32_t *nets);
+static Netlist *netlist_flatten(Library *library, ChipDef *chip,
+                                bool optimize, bool rams);
+
+static bool flatten_part(Netlist *self, ChipDef const *chip, Part *part,
+                         Signal **scope, size_t *length, size_t *capacity) {
+  /* Connects the pins of a part to the signals of the chip, internal pins
+   * being created as they first appear, and flattens it */
+  if (part->def == NULL && (part->def = library_find(self->library,
+                                                     part->chip)) == NULL) {
+    fprintf(stderr, "%s:%zu: In %s\n", chip->path, part->line, chip->name);
+    return false;
+  }
+  ChipDef *sub = part->def;
+  uint32_t *nets = malloc(sub->nBits * sizeof(uint32_t));
+  if (nets == NULL) {
+    perror("Failed to allocate memory!");
+    return false;
+  }
+  // Unconnected inputs are false
+  for (size_t i = 0; i < sub->nInputs + sub->nOutputs; i++) {
+    Pin const *pin = &sub->pins[i];
+    for (unsigned bit = 0; bit < pin->width; bit++)
+      nets[pin->offset + bit] =
+          (i < sub->nInputs) ? NET_FALSE : net_new(self, false);
+  }
+  char const *error = NULL;
+  for (size_t i = 0; !error && i < part->nConnections; i++) {
+    Connection const *connection = &part->connections[i];
+    Pin const *pin = chip_pin(sub, connection->pin);
+    if (pin == NULL) {
+      error = "No such pin";
+      break;
+    }
+    bool input = pin < sub->pins + sub->nInputs;
+    int from = (connection->pinFrom < 0) ? 0 : connection->pinFrom;
+    int to = (connection->pinFrom < 0) ? (int)pin->width - 1
+                                       : connection->pinTo;
+    if (to >= (int)pin->width) {
+      error = "Bits out of range";
+      break;
+    }
+    unsigned width = to - from + 1;
+    if (!strcmp(connection->signal, "true") ||
+        !strcmp(connection->signal, "false")) {
+      if (!input || connection->signalFrom >= 0)
+        error = "Invalid constant";
+      for (unsigned bit = 0; bit < width; bit++)
+        nets[pin->offset + from + bit] =
+            (*connection->signal == 't') ? NET_TRUE : NET_FALSE;
+      continue;
+    }
+    Signal *signal = scope_find(*scope, *length, connection->signal);
+    if (signal == NULL) {
+      if (connection->signalFrom >= 0) {
+        error = "Sub bus of an undefined pin";
+        break;
+      }
+      if (!grow(scope, capacity, *length, sizeof(Signal))) {
+        free(nets);
+        return false;
+      }
+      signal = &(*scope)[(*length)++];
+      *signal = (Signal){connection->signal, malloc(width * sizeof(uint32_t)),
+                         width, true};
+      if (signal->nets == NULL) {
+        perror("Failed to allocate memory!");
+        free(nets);
+        return false;
+      }
+      for (unsigned bit = 0; bit < width; bit++)
+        signal->nets[bit] = net_new(self, false);
+    }
+    int signalFrom = (connection->signalFrom < 0) ? 0 : connection->signalFrom;
+    int signalTo = (connection->signalFrom < 0) ? (int)signal->width - 1
+                                                : connection->signalTo;
+    if (signalTo >= (int)signal->width)
+      error = "Bits out of range";
+    else if ((unsigned)(signalTo - signalFrom + 1) != width)
+      error = "Width mismatch";
+    for (unsigned bit = 0; !error && bit < width; bit++) {
+      if (input)
+        nets[pin->offset + from + bit] = signal->nets[signalFrom + bit];
+      else if (!net_join(self, nets[pin->offset + from + bit],
+                         signal->nets[signalFrom + bit]))
+        error = "Pin driven more than once";
+    }
+  }
+  if (error) {
+    fprintf(stderr, "%s:%zu: %s: %s\n", chip->path, part->line, error,
+            part->chip);
+    free(nets);
+    return false;
+  }
+  uint32_t parent = self->part;
+  if (self->depth <= MAX_PROBE_DEPTH) {
+    if (!grow(&self->probes, &self->probeCapacity, self->nProbes,
+              sizeof(Probe))) {
+      free(nets);
+      return false;
+    }
+    Pin const *out = chip_pin(sub, "out");
+    Probe *probe = &self->probes[self->part = self->nProbes++];
+    *probe = (Probe){part->chip, parent, 0, {0}};
+    if (out && out->width <= MAX_BUS_WIDTH) {
+      probe->width = out->width;
+      memcpy(probe->out, nets + out->offset, out->width * sizeof(uint32_t));
+    }
+  }
+  bool ok = flatten(self, sub, nets);
+  self->part = parent;
+  if (!ok)
+    fprintf(stderr, "%s:%zu: In %s\n", chip->path, part->line, chip->name);
+  free(nets);
+  return ok;
+}
+
+static bool flatten_copy(Netlist *self, ChipDef const *chip,
+                         Netlist const *flat, uint32_t const *nets) {
+  /* Adds the cells of a chip flattened alone, with its pins connected to
+   * the given nets and new nets for the others */
+  uint32_t *map = malloc(flat->nNets * sizeof(uint32_t));
+  if (map == NULL) {
+    perror("Failed to allocate memory!");
+    return false;
+  }
+  bool ok = true, driven = true;
+  map[NET_FALSE] = NET_FALSE;
+  map[NET_TRUE] = NET_TRUE;
+  for (size_t i = 2; i < flat->nNets; i++)
+    map[i] = NO_CELL;
+  // Output pins the chip connects together stay so
+  for (unsigned bit = 0; ok && bit < chip->nBits; bit++) {
+    uint32_t *net = &map[flat->pins[bit]];
+    if (*net == NO_CELL)
+      *net = nets[bit];
+    else
+      ok = driven = net_join(self, *net, nets[bit]);
+  }
+  for (size_t i = 2; ok && i < flat->nNets; i++) {
+    if (map[i] == NO_CELL && (map[i] = net_new(self, false)) == NET_FALSE)
+      ok = false;
+  }
+  for (size_t i = 0; ok && i < flat->nCells; i++) {
+    if (!(ok = grow(&self->cells, &self->cellCapacity, self->nCells,
+                    sizeof(Cell))))
+      break;
+    Cell cell = flat->cells[i];
+    cell.level = 0;
+    cell.part = self->part;
+    if (cell.op == OP_WORD) {
+      Word word = flat->words[cell.a];
+      for (unsigned bit = 0; bit < word.width; bit++) {
+        word.a[bit] = map[word.a[bit]];
+        word.b[bit] = map[word.b[bit]];
+        word.out[bit] = map[word.out[bit]];
+      }
+      word.c = map[word.c];
+      word.carry = map[word.carry];
+      if (!(ok = grow(&self->words, &self->wordCapacity, self->nWords,
+                      sizeof(Word))))
+        break;
+      self->words[cell.a = self->nWords++] = word;
+    } else if (cell.op == OP_MEMORY) {
+      Memory memory = flat->memories[cell.a];
+      memory.load = map[memory.load];
+      for (unsigned bit = 0; bit < MAX_BUS_WIDTH; bit++) {
+        memory.address[bit] = map[memory.address[bit]];
+        memory.in[bit] = map[memory.in[bit]];
+        memory.out[bit] = map[memory.out[bit]];
+      }
+      size_t size = (memory.stride) ? LANES * memory.stride
+                                    : (size_t)1 << memory.width;
+      if (!(ok = grow(&self->memories, &self->memoryCapacity,
+                      self->nMemories, sizeof(Memory))))
+        break;
+      if ((memory.words = calloc(size, sizeof(uint16_t))) == NULL) {
+        perror("Failed to allocate memory!");
+        ok = false;
+        break;
+      }
+      self->memories[cell.a = self->nMemories++] = memory;
+    } else {
+      cell.a = map[cell.a];
+      cell.b = map[cell.b];
+      cell.c = map[cell.c];
+      cell.out = map[cell.out];
+    }
+    self->cells[self->nCells++] = cell;
+    uint32_t outputs[MAX_CELL_NETS];
+    unsigned nOutputs = cell_outputs(self, &cell, outputs);
+    for (unsigned j = 0; ok && j < nOutputs; j++)
+      ok = driven = outputs[j] <= NET_TRUE || net_drive(self, outputs[j]);
+  }
+  for (size_t i = 0; ok && i < flat->nFlops; i++) {
+    if (!(ok = grow(&self->flops, &self->flopCapacity, self->nFlops,
+                    sizeof(Flop))))
+      break;
+    Flop const *flop = &flat->flops[i];
+    self->flops[self->nFlops++] =
+        (Flop){map[flop->in], map[flop->out], self->part};
+    ok = driven = net_drive(self, map[flop->out]);
+  }
+  if (!driven)
+    fprintf(stderr, "%s: Output connected to a pin with a driver\n",
+            chip->name);
+  free(map);
+  return ok;
+}
+
+static bool flatten(Netlist *self, ChipDef *chip, uint32_t *nets) {
+  // Adds the cells of a chip whose pins connect to the given nets
+  if (chip->builtin)
+    return flatten_builtin(self, chip, nets);
+  if (chip->flattening) {
+    fprintf(stderr, "%s: %s is made of itself\n", chip->path, chip->name);
+    return false;
+  }
+  if (self->rams && chip_ram(self, chip) > 0) {
+    bool ok = flatten_memory(self, chip, RAM, nets);
+    if (!ok)
+      fprintf(stderr, "%s: Output connected to a pin with a driver\n",
+              chip->name);
+    return ok;
+  }
+  if (self->optimize && chip->lowered == 0 && !chip_lower(self, chip))
+    return false;
+  if (self->optimize && chip->lowered == 1)
+    return flatten_lowered(self, chip, nets);
+  if (self->depth > MAX_PROBE_DEPTH) {
+    // Below the probes, every instance is a copy of the chip flattened once
+    Netlist *flat = chip->flat;
+    if (flat == NULL || flat->optimize != self->optimize ||
+        flat->rams != self->rams) {
+      flat = netlist_flatten(self->library, chip, self->optimize, self->rams);
+      if (flat == NULL)
+        return false;
+      if (chip->flat)
+        netlist_del(chip->flat);
+      chip->flat = flat;
+    }
+    return flatten_copy(self, chip, flat, nets);
+  }
+  Signal *scope = NULL;
+  size_t length = 0, capacity = 0;
+  bool ok = true;
+  for (size_t i = 0; ok && i < chip->nInputs + chip->nOutputs; i++) {
+    Pin const *pin = &chip->pins[i];
+    if ((ok = grow(&scope, &capacity, length, sizeof(Signal))))
+      scope[length++] =
+          (Signal){pin->name, nets + pin->offset, pin->width, false};
+  }
+  chip->flattening = true;
+  self->depth++;
+  size_t start = self->nCells;
+  for (size_t i = 0; ok && i < chip->nParts; i++)
+    ok = flatten_part(self, chip, &chip->parts[i], &scope, &length,
+                      &capacity);
+  self->depth--;
+  chip->flattening = false;
+  if (ok && self->optimize)
+    ok = group_word(self, start, nets, chip->nBits);
+  for (size_t i = 0; ok && self->depth == 0 && i < length; i++) {
+    // Those of the top chip stay visible
+    if (!scope[i].own || scope[i].width > MAX_BUS_WIDTH)
+      continue;
+    if (!(ok = grow(&self->wires, &self->wireCapacity, self->nWires,
+                    sizeof(Probe))))
+      break;
+    Probe *wire = &self->wires[self->nWires++];
+    *wire = (Probe){scope[i].name, NO_PROBE, scope[i].width, {0}};
+    memcpy(wire->out, scope[i].nets, scope[i].width * sizeof(uint32_t));
+  }
+  for (size_t i = 0; i < length; i++) {
+    if (scope[i].own)
+      free(scope[i].nets);
+  }
+  free(scope);
+  return ok;
+}
+// levelize {{{2
+static bool levelize(Netlist *self) {
+  /* Orders the cells so that every one comes after the cells driving its
+   * inputs, failing on combinational loops */
+  size_t n = self->nCells;
+  uint32_t *driver = malloc(self->nNets * sizeof(uint32_t));
+  uint32_t *level = calloc(n, sizeof(uint32_t));
+  uint32_t *stack = NULL;
+  size_t depth = 0, capacity = 0;
+  Cell *sorted = malloc(n * sizeof(Cell));
+  size_t *count = NULL;
+  bool ok = driver && level && sorted;
+  if (!ok)
+    perror("Failed to allocate memory!");
+  for (size_t i = 0; ok && i < self->nNets; i++)
+    driver[i] = NO_CELL;
+  uint32_t inputs[MAX_CELL_NETS];
+  for (size_t i = 0; ok && i < n; i++) {
+    unsigned nOutputs = cell_outputs(self, &self->cells[i], inputs);
+    for (unsigned j = 0; j < nOutputs; j++)
+      driver[inputs[j]] = i;
+  }
+  driver[NET_FALSE] = driver[NET_TRUE] = NO_CELL;
+
+  // Depth first, a cell is visited once all its drivers are
+  uint32_t const VISITING = UINT32_MAX;
+  for (size_t i = 0; ok && i < n; i++) {
+    if (level[i])
+      continue;
+    if (!(ok = grow(&stack, &capacity, depth, sizeof(uint32_t))))
+      break;
+    stack[depth++] = i;
+    while (ok && depth) {
+      uint32_t top = stack[depth - 1];
+      unsigned nInputs = cell_inputs(self, &self->cells[top], inputs);
+      if (level[top] == 0) {
+        level[top] = VISITING;
+        for (unsigned j = 0; ok && j < nInputs; j++) {
+          uint32_t d = driver[inputs[j]];
+          if (d == NO_CELL || (level[d] && level[d] != VISITING))
+            continue;
+          if (level[d] == VISITING) {
+            fprintf(stderr, "%s: Combinational loop\n", self->chip->path);
+            ok = false;
+          } else if ((ok = grow(&stack, &capacity, depth, sizeof(uint32_t))))
+            stack[depth++] = d;
+        }
+        continue;
+      }
+      depth--;
+      if (level[top] != VISITING)
+        continue;
+      uint32_t max = 0;
+      for (unsigned j = 0; j < nInputs; j++) {
+        uint32_t d = driver[inputs[j]];
+        if (d != NO_CELL && level[d] > max)
+          max = level[d];
+      }
+      level[top] = max + 1;
+      if (max + 1 > self->nLevels)
+        self->nLevels = max + 1;
+    }
+  }
+
+  // Counting sort by level, keeping the order within a level
+  if (ok && (count = calloc(self->nLevels + 2, sizeof(size_t))) == NULL) {
+    perror("Failed to allocate memory!");
+    ok = false;
+  }
+  if (ok) {
+    for (size_t i = 0; i < n; i++)
+      count[level[i] + 1]++;
+    for (size_t l = 1; l <= self->nLevels + 1; l++)
+      count[l] += count[l - 1];
+    for (size_t i = 0; i < n; i++) {
+      self->cells[i].level = level[i];
+      sorted[count[level[i]]++] = self->cells[i];
+    }
+    free(self->cells);
+    self->cells = sorted;
+    sorted = NULL;
+  }
+  free(count);
+  free(sorted);
+  free(stack);
+  free(level);
+  free(driver);
+  return ok;
+}
+// netlist_flatten {{{2
+static Netlist *netlist_flatten(Library *library, ChipDef *chip,
+                                bool optimize, bool rams) {
+  /* Flattens a chip into Nand gates, flip-flops and memories connected by
+   * nets, the first two of which are the constants. Optimized, small chips
+   * become single gates and buses of them words. With rams, the RAM chips
+   * become memories. */
+  Netlist *self = calloc(1, sizeof(Netlist));
+  if (self == NULL) {
+    perror("Failed to allocate memory!");
+    return NULL;
+  }
+  self->chip = chip;
+  self->library = library;
+  self->optimize = optimize;
+  self->rams = rams;
+  self->lanes = 1;
+  self->part = NO_PROBE;
+  net_new(self, true);
+  net_new(self, true);
+  self->pins = malloc(chip->nBits * sizeof(uint32_t));
+  if (self->pins == NULL) {
+    perror("Failed to allocate memory!");
+    netlist_del(self);
+    return NULL;
+  }
+  unsigned nInputBits = (chip->nOutputs) ? chip->pins[chip->nInputs].offset
+                                         : chip->nBits;
+  for (unsigned bit = 0; bit < chip->nBits; bit++)
+    self->pins[bit] = net_new(self, bit < nInputBits);
+  if (self->nNets < 2 + chip->nBits || !flatten(self, chip, self->pins)) {
+    netlist_del(self);
+    return NULL;
+  }
+
+  // Number the nets connected together as one
+  uint32_t *number = malloc(self->nNets * sizeof(uint32_t));
+  if (number == NULL) {
+    perror("Failed to allocate memory!");
+    netlist_del(self);
+    return NULL;
+  }
+  size_t nNets = 0;
+  for (size_t i = 0; i < self->nNets; i++)
+    number[i] = (net_find(self, i) == i) ? nNets++ : 0;
+  for (size_t i = 0; i < self->nNets; i++)
+    number[i] = number[net_find(self, i)];
+  for (size_t i = 0; i < chip->nBits; i++)
+    self->pins[i] = number[self->pins[i]];
+  for (size_t i = 0; i < self->nCells; i++) {
+    Cell *cell = &self->cells[i];
+    if (cell->op != OP_WORD && cell->op != OP_MEMORY) {
+      cell->a = number[cell->a];
+      cell->b = number[cell->b];
+      cell->c = number[cell->c];
+      cell->out = number[cell->out];
+    }
+  }
+  for (size_t i = 0; i < self->nWords; i++) {
+    Word *word = &self->words[i];
+    for (unsigned bit = 0; bit < word->width; bit++) {
+      word->a[bit] = number[word->a[bit]];
+      word->b[bit] = number[word->b[bit]];
+      word->out[bit] = number[word->out[bit]];
+    }
+    word->c = number[word->c];
+    word->carry = number[word->carry];
+  }
+  for (size_t i = 0; i < self->nProbes; i++) {
+    for (unsigned bit = 0; bit < self->probes[i].width; bit++)
+      self->probes[i].out[bit] = number[self->probes[i].out[bit]];
+  }
+  for (size_t i = 0; i < self->nWires; i++) {
+    for (unsigned bit = 0; bit < self->wires[i].width; bit++)
+      self->wires[i].out[bit] = number[self->wires[i].out[bit]];
+  }
+  for (size_t i = 0; i < self->nFlops; i++) {
+    self->flops[i].in = number[self->flops[i].in];
+    self->flops[i].out = number[self->flops[i].out];
+  }
+  for (size_t i = 0; i < self->nMemories; i++) {
+    Memory *memory = &self->memories[i];
+    memory->load = number[memory->load];
+    for (unsigned bit = 0; bit < MAX_BUS_WIDTH; bit++) {
+      memory->address[bit] = number[memory->address[bit]];
+      memory->in[bit] = number[memory->in[bit]];
+      memory->out[bit] = number[memory->out[bit]];
+    }
+  }
+  free(number);
+  free(self->parent);
+  free(self->driven);
+  self->parent = NULL;
+  self->driven = NULL;
+  self->nNets = nNets;
+  return self;
+}
+// netlist_new {{{2
+Netlist *netlist_new(Library *library, ChipDef *chip, bool optimize,
+                     bool rams) {
+  // Flattens a chip and orders its cells to simulate it
+  Netlist *self = netlist_flatten(library, chip, optimize, rams);
+  if (self == NULL)
+    return NULL;
+  self->values = values_new(self->nNets);
+  self->state = values_new(self->nFlops + 1);
+  if (self->values == NULL || self->state == NULL) {
+    perror("Failed to allocate memory!");
+    netlist_del(self);
+    return NULL;
+  }
+  self->values[NET_TRUE] = ALL_LANES;
+  if (!levelize(self)) {
+    netlist_del(self);
+    return NULL;
+  }
+  return self;
+}
+// simulation {{{1
+// memory_address {{{2
+static unsigned memory_address(Memory const *self, Value const *values,
+                               unsigned lane) {
+  unsigned address = 0;
+  for (unsigned bit = 0; bit < self->width; bit++)
+    address |= (unsigned)lane_get(&values[self->address[bit]], lane) << bit;
+  return address;
+}
+// memory_read {{{2
+static void memory_read(Memory const *self, Value *values, unsigned lanes) {
+  Value out[MAX_BUS_WIDTH] = {0};
+  for (unsigned lane = 0; lane < lanes; lane++) {
+    uint16_t word = self->words[lane * self->stride +
+                                memory_address(self, values, lane)];
+    for (unsigned bit = 0; bit < MAX_BUS_WIDTH; bit++)
+      lane_set(&out[bit], lane, word >> bit & 1);
+  }
+  for (unsigned bit = 0; bit < MAX_BUS_WIDTH; bit++)
+    values[self->out[bit]] = out[bit];
+}
+
+static void compiled_read(void *netlist, unsigned memory, Value *values) {
+  // Called back by the compiled netlist
+  Netlist const *self = netlist;
+  memory_read(&self->memories[memory], values, self->lanes);
+}
+// netlist_eval {{{2
+static inline Value gate_eval(Op op, Value a, Value b, Value c) {
+  switch (op) {
+  case OP_NAND:
+    return ~(a & b);
+  case OP_NOT:
+    return ~a;
+  case OP_AND:
+    return a & b;
+  case OP_OR:
+    return a | b;
+  case OP_XOR:
+    return a ^ b;
+  case OP_NOR:
+    return ~(a | b);
+  case OP_XNOR:
+    return ~(a ^ b);
+  case OP_ANDN:
+    return a & ~b;
+  case OP_MUX:
+    return (a & ~c) | (b & c);
+  case OP_XOR3:
+    return a ^ b ^ c;
+  default: // OP_MAJ
+    return (a & b) | (c & (a ^ b));
+  }
+}
+
+static void word_eval(Word const *self, Value *v) {
+  if (self->op == OP_ADD) {
+    Value carry = v[self->c];
+    for (unsigned bit = 0; bit < self->width; bit++) {
+      Value a = v[self->a[bit]], b = v[self->b[bit]];
+      v[self->out[bit]] = a ^ b ^ carry;
+      carry = (a & b) | (carry & (a ^ b));
+    }
+    v[self->carry] = carry;
+    return;
+  }
+  Value c = v[self->c];
+  for (unsigned bit = 0; bit < self->width; bit++)
+    v[self->out[bit]] =
+        gate_eval(self->op, v[self->a[bit]], v[self->b[bit]], c);
+}
+
+static inline void cell_eval(Netlist *self, Cell const *cell) {
+  Value *v = self->values;
+  switch (cell->op) {
+  case OP_NAND:
+    v[cell->out] = ~(v[cell->a] & v[cell->b]);
+    break;
+  case OP_WORD:
+    word_eval(&self->words[cell->a], v);
+    break;
+  case OP_MEMORY:
+    memory_read(&self->memories[cell->a], v, self->lanes);
+    break;
+  default:
+    v[cell->out] = gate_eval(cell->op, v[cell->a], v[cell->b], v[cell->c]);
+  }
+}
+
+static void netlist_schedule(Netlist *self, uint32_t reader) {
+  // Queues a cell, or a flip-flop after the cells, to look at its inputs
+  if (self->marks[reader] & MARK_SCHEDULED)
+    return;
+  self->marks[reader] |= MARK_SCHEDULED;
+  if (reader >= self->nCells) {
+    self->dirty[self->nDirty++] = reader - self->nCells;
+    return;
+  }
+  uint32_t level = self->cells[reader].level;
+  self->queue[self->levelStart[level] + self->queued[level]++] = reader;
+}
+
+static void netlist_touch(Netlist *self, uint32_t net) {
+  // Schedules what reads a net that changed
+  for (uint32_t i = self->fanoutStart[net]; i < self->fanoutStart[net + 1];
+       i++)
+    netlist_schedule(self, self->fanout[i]);
+}
+
+void netlist_eval(Netlist *self) {
+  /* Settles every net after the inputs or the flip-flops changed. Once the
+   * events are set up, only the cells reading nets that changed are
+   * evaluated, level by level. */
+  if (self->compiledEval) {
+    self->compiledEval(self->values, self, compiled_read);
+    return;
+  }
+  if (!self->events) {
+    for (Cell const *cell = self->cells, *end = cell + self->nCells;
+         cell < end; cell++)
+      cell_eval(self, cell);
+    return;
+  }
+  Value *v = self->values;
+  uint32_t outputs[MAX_CELL_NETS];
+  Value old[MAX_BUS_WIDTH + 1];
+  for (size_t level = 1; level <= self->nLevels; level++) {
+    uint32_t const *queue = self->queue + self->levelStart[level];
+    for (uint32_t i = 0; i < self->queued[level]; i++) {
+      Cell const *cell = &self->cells[queue[i]];
+      self->marks[queue[i]] &= ~MARK_SCHEDULED;
+      unsigned nOutputs = cell_outputs(self, cell, outputs);
+      for (unsigned j = 0; j < nOutputs; j++)
+        old[j] = v[outputs[j]];
+      cell_eval(self, cell);
+      for (unsigned j = 0; j < nOutputs; j++) {
+        if (value_differs(old[j], v[outputs[j]]))
+          netlist_touch(self, outputs[j]);
+      }
+    }
+    self->queued[level] = 0;
+  }
+}
+// netlist_events {{{2
+bool netlist_events(Netlist *self) {
+  /* Sets up the event driven evaluation: finds what reads every net and
+   * settles them all once */
+  size_t nReaders = self->nCells + self->nFlops;
+  self->fanoutStart = calloc(self->nNets + 2, sizeof(uint32_t));
+  self->levelStart = calloc(self->nLevels + 2, sizeof(uint32_t));
+  self->queued = calloc(self->nLevels + 2, sizeof(uint32_t));
+  self->queue = malloc((self->nCells + 1) * sizeof(uint32_t));
+  self->marks = calloc(nReaders + 1, sizeof(uint8_t));
+  self->dirty = malloc((self->nFlops + 1) * sizeof(uint32_t));
+  self->sampled = malloc((self->nFlops + 1) * sizeof(uint32_t));
+  if (!self->fanoutStart || !self->levelStart || !self->queued ||
+      !self->queue || !self->marks || !self->dirty || !self->sampled) {
+    perror("Failed to allocate memory!");
+    return false;
+  }
+
+  // Count the readers of every net, then fill them in
+  uint32_t inputs[MAX_CELL_NETS];
+  for (size_t i = 0; i < self->nCells; i++) {
+    unsigned nInputs = cell_inputs(self, &self->cells[i], inputs);
+    for (unsigned j = 0; j < nInputs; j++)
+      self->fanoutStart[inputs[j] + 2]++;
+    self->levelStart[self->cells[i].level + 1]++;
+    if (self->cells[i].op == OP_MEMORY)
+      self->memories[self->cells[i].a].cell = i;
+  }
+  for (size_t i = 0; i < self->nFlops; i++)
+    self->fanoutStart[self->flops[i].in + 2]++;
+  for (size_t net = 0; net < self->nNets; net++)
+    self->fanoutStart[net + 2] += self->fanoutStart[net + 1];
+  for (size_t level = 1; level <= self->nLevels; level++)
+    self->levelStart[level + 1] += self->levelStart[level];
+  self->fanout = malloc((self->fanoutStart[self->nNets + 1] + 1) *
+                        sizeof(uint32_t));
+  if (self->fanout == NULL) {
+    perror("Failed to allocate memory!");
+    return false;
+  }
+  for (size_t i = 0; i < self->nCells; i++) {
+    unsigned nInputs = cell_inputs(self, &self->cells[i], inputs);
+    for (unsigned j = 0; j < nInputs; j++)
+      self->fanout[self->fanoutStart[inputs[j] + 1]++] = i;
+  }
+  for (size_t i = 0; i < self->nFlops; i++)
+    self->fanout[self->fanoutStart[self->flops[i].in + 1]++] =
+        self->nCells + i;
+
+  // Every flip-flop takes its input at the first tick
+  netlist_eval(self);
+  for (size_t i = 0; i < self->nFlops; i++)
+    netlist_schedule(self, self->nCells + i);
+  self->events = true;
+  return true;
+}
+// netlist_tick {{{2
+void netlist_tick(Netlist *self) {
+  // The clock rises: flip-flops and memories take their inputs
+  netlist_eval(self);
+  Value *v = self->values;
+  if (self->events) {
+    // Only those whose input changed, until the tock
+    for (size_t i = 0; i < self->nDirty; i++) {
+      uint32_t flop = self->dirty[i];
+      uint8_t *mark = &self->marks[self->nCells + flop];
+      self->state[flop] = v[self->flops[flop].in];
+      if (!(*mark & MARK_SAMPLED))
+        self->sampled[self->nSampled++] = flop;
+      *mark = MARK_SAMPLED;
+    }
+    self->nDirty = 0;
+  } else if (self->compiledTick)
+    self->compiledTick(v, self->state);
+  else {
+    for (size_t i = 0; i < self->nFlops; i++)
+      self->state[i] = v[self->flops[i].in];
+  }
+  for (size_t i = 0; i < self->nMemories; i++) {
+    Memory *memory = &self->memories[i];
+    for (unsigned lane = 0; lane < self->lanes; lane++) {
+      memory->write[lane] = lane_get(&v[memory->load], lane);
+      if (!memory->write[lane])
+        continue;
+      memory->writeAddress[lane] = memory_address(memory, v, lane);
+      memory->writeValue[lane] = 0;
+      for (unsigned bit = 0; bit < MAX_BUS_WIDTH; bit++)
+        memory->writeValue[lane] |=
+            (uint16_t)(lane_get(&v[memory->in[bit]], lane) << bit);
+    }
+  }
+}
+// netlist_tock {{{2
+void netlist_tock(Netlist *self) {
+  // The clock falls: flip-flops and memories show what they took
+  Value *v = self->values;
+  if (self->events) {
+    for (size_t i = 0; i < self->nSampled; i++) {
+      uint32_t flop = self->sampled[i];
+      self->marks[self->nCells + flop] &= ~MARK_SAMPLED;
+      if (value_differs(v[self->flops[flop].out], self->state[flop])) {
+        v[self->flops[flop].out] = self->state[flop];
+        netlist_touch(self, self->flops[flop].out);
+      }
+    }
+    self->nSampled = 0;
+  } else if (self->compiledTock)
+    self->compiledTock(v, self->state);
+  else {
+    for (size_t i = 0; i < self->nFlops; i++)
+      v[self->flops[i].out] = self->state[i];
+  }
+  for (size_t i = 0; i < self->nMemories; i++) {
+    Memory *memory = &self->memories[i];
+    for (unsigned lane = 0; lane < self->lanes; lane++) {
+      uint16_t *word =
+          &memory->words[lane * memory->stride + memory->writeAddress[lane]];
+      if (memory->write[lane] && *word != memory->writeValue[lane]) {
+        *word = memory->writeValue[lane];
+        if (self->events)
+          netlist_schedule(self, memory->cell);
+      }
+      memory->write[lane] = false;
+    }
+  }
+  netlist_eval(self);
+}
+// netlist_set {{{2
+void netlist_set(Netlist *self, Pin const *pin, int value) {
+  // Sets an input of the chip in every lane
+  for (unsigned bit = 0; bit < pin->width; bit++) {
+    uint32_t net = self->pins[pin->offset + bit];
+    Value new = (value >> bit & 1) ? ALL_LANES : (Value){0};
+    if (self->events && value_differs(self->values[net], new))
+      netlist_touch(self, net);
+    self->values[net] = new;
+  }
+}
+// netlist_get {{{2
+int netlist_get(Netlist const *self, Pin const *pin, unsigned lane) {
+  // Buses of 16 bits are signed, as everywhere on the Hack platform
+  int value = 0;
+  for (unsigned bit = 0; bit < pin->width; bit++)
+    value |= lane_get(&self->values[self->pins[pin->offset + bit]], lane)
+             << bit;
+  if (pin->width == 16)
+    value = (int16_t)value;
+  return value;
+}
+// netlist_probe {{{2
+int netlist_probe(Netlist const *self, Probe const *probe, unsigned lane) {
+  // Same as netlist_get for the out pin of a part or an internal pin
+  int value = 0;
+  for (unsigned bit = 0; bit < probe->width; bit++)
+    value |= lane_get(&self->values[probe->out[bit]], lane) << bit;
+  if (probe->width == 16)
+    value = (int16_t)value;
+  return value;
+}
+// netlist_load_rom {{{2
+bool netlist_load_rom(Netlist *self, char const *path) {
+  // Fills every ROM32K with a .hack file
+  char line[MAX_LINE_LENGTH];
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    perror(path);
+    return false;
+  }
+  size_t length = 0;
+  bool ok = true;
+  for (size_t lineNumber = 1; ok && fgets(line, sizeof(line), file);
+       lineNumber++) {
+    if (strspn(line, " \t\r\n") == strlen(line))
+      continue;
+    if (strspn(line, "01") != 16 || length == (1U << 15)) {
+      fprintf(stderr, "%s:%zu: Invalid instruction\n", path, lineNumber);
+      ok = false;
+      break;
+    }
+    uint16_t word = (uint16_t)strtoul(line, NULL, 2);
+    for (size_t i = 0; i < self->nMemories; i++) {
+      if (self->memories[i].kind == ROM32K)
+        self->memories[i].words[length] = word;
+      if (self->memories[i].kind == ROM32K && self->events)
+        netlist_schedule(self, self->memories[i].cell);
+    }
+    length++;
+  }
+  fclose(file);
+  return ok;
+}
+// compilation {{{1
+// declarations {{{2
+#define MAX_COMPILED_CELLS (1U << 18) // More takes the compiler too long
+
+/* The generated code has the same Value as hdl, so the values of the nets
+ * and the state of the flip-flops are shared as they are */
+#if LANES == 64
+#define VALUE_TYPEDEF "typedef uint64_t Value;\n"
+#else
+#define STRINGIFY(x) #x
+#define VALUE_TYPEDEF_OF(lanes)                                               \
+  "typedef uint64_t Value __attribute__((vector_size(" STRINGIFY(lanes)       \
+  " / 8)));\n"
+#define VALUE_TYPEDEF VALUE_TYPEDEF_OF(LANES)
+#endif
+// emit_gate {{{2
+static void emit_gate(FILE *output, Op op, uint32_t a, uint32_t b,
+                      uint32_t c) {
+  // Prints the expression gate_eval computes
+  switch (op) {
+  case OP_NAND:
+    fprintf(output, "~(v[%u] & v[%u])", a, b);
+    break;
+  case OP_NOT:
+    fprintf(output, "~v[%u]", a);
+    break;
+  case OP_AND:
+    fprintf(output, "v[%u] & v[%u]", a, b);
+    break;
+  case OP_OR:
+    fprintf(output, "v[%u] | v[%u]", a, b);
+    break;
+  case OP_XOR:
+    fprintf(output, "v[%u] ^ v[%u]", a, b);
+    break;
+  case OP_NOR:
+    fprintf(output, "~(v[%u] | v[%u])", a, b);
+    break;
+  case OP_XNOR:
+    fprintf(output, "~(v[%u] ^ v[%u])", a, b);
+    break;
+  case OP_ANDN:
+    fprintf(output, "v[%u] & ~v[%u]", a, b);
+    break;
+  case OP_MUX:
+    fprintf(output, "(v[%u] & ~v[%u]) | (v[%u] & v[%u])", a, c, b, c);
+    break;
+  case OP_XOR3:
+    fprintf(output, "v[%u] ^ v[%u] ^ v[%u]", a, b, c);
+    break;
+  default: // OP_MAJ
+    fprintf(output, "(v[%u] & v[%u]) | (v[%u] & (v[%u] ^ v[%u]))", a, b, c,
+            a, b);
+  }
+}
+// emit_netlist {{{2
+static void emit_netlist(Netlist const *self, FILE *output) {
+  /* Prints a C function evaluating every cell in order, with no dispatch,
+   * and two moving the state of the flip-flops */
+  fprintf(output, "// %s, generated by hdl\n#include <stdint.h>\n\n",
+          self->chip->path);
+  fputs(VALUE_TYPEDEF, output);
+  fputs("\nvoid eval(Value *restrict v, void *netlist,\n"
+        "          void (*read)(void *, unsigned, Value *)) {\n",
+        output);
+  for (size_t i = 0; i < self->nCells; i++) {
+    Cell const *cell = &self->cells[i];
+    if (cell->op == OP_MEMORY) {
+      fprintf(output, "  read(netlist, %u, v);\n", cell->a);
+      continue;
+    }
+    if (cell->op != OP_WORD) {
+      fprintf(output, "  v[%u] = ", cell->out);
+      emit_gate(output, cell->op, cell->a, cell->b, cell->c);
+      fputs(";\n", output);
+      continue;
+    }
+    Word const *word = &self->words[cell->a];
+    if (word->op != OP_ADD) {
+      for (unsigned bit = 0; bit < word->width; bit++) {
+        fprintf(output, "  v[%u] = ", word->out[bit]);
+        emit_gate(output, word->op, word->a[bit], word->b[bit], word->c);
+        fputs(";\n", output);
+      }
+      continue;
+    }
+    fprintf(output, "  {\n    Value c = v[%u];\n", word->c);
+    for (unsigned bit = 0; bit < word->width; bit++)
+      fprintf(output,
+              "    {\n      Value a = v[%u], b = v[%u];\n"
+              "      v[%u] = a ^ b ^ c;\n"
+              "      c = (a & b) | (c & (a ^ b));\n    }\n",
+              word->a[bit], word->b[bit], word->out[bit]);
+    fprintf(output, "    v[%u] = c;\n  }\n", word->carry);
+  }
+  fputs("}\n\nvoid tick(Value const *restrict v, Value *restrict s) {\n",
+        output);
+  for (size_t i = 0; i < self->nFlops; i++)
+    fprintf(output, "  s[%zu] = v[%u];\n", i, self->flops[i].in);
+  fputs("}\n\nvoid tock(Value *restrict v, Value const *restrict s) {\n",
+        output);
+  for (size_t i = 0; i < self->nFlops; i++)
+    fprintf(output, "  v[%u] = s[%zu];\n", self->flops[i].out, i);
+  fputs("}\n", output);
+}
+// netlist_compile {{{2
+bool netlist_compile(Netlist *self) {
+  /* Generates C for the netlist, builds it into a shared library with the
+   * compiler of $CC and loads it, so that evaluating it costs no dispatch
+   * per cell. The memories stay simulated by hdl. */
+  if (self->nCells > MAX_COMPILED_CELLS) {
+    fprintf(stderr, "%s: Too many cells to compile, try -O or -M\n",
+            self->chip->path);
+    return false;
+  }
+  char const *dir = getenv("TMPDIR");
+  char const *cc = getenv("CC");
+  if (dir == NULL || *dir == '\0')
+    dir = "/tmp";
+  if (strchr(dir, '\'')) {
+    fprintf(stderr, "%s: TMPDIR must not contain a quote\n", dir);
+    return false;
+  }
+  // Both files live in a directory only this user can write to
+  char temp[PATH_MAX - sizeof("/hdl.so")];
+  char source[PATH_MAX], library[PATH_MAX];
+  char command[2 * PATH_MAX + MAX_LINE_LENGTH];
+  errno = ENAMETOOLONG;
+  if (snprintf(temp, sizeof(temp), "%s/hdl-XXXXXX", dir) >=
+          (int)sizeof(temp) ||
+      mkdtemp(temp) == NULL) {
+    perror(dir);
+    return false;
+  }
+  snprintf(source, sizeof(source), "%s/hdl.c", temp);
+  snprintf(library, sizeof(library), "%s/hdl.so", temp);
+  FILE *file = fopen(source, "w");
+  bool ok = file != NULL;
+  if (file) {
+    emit_netlist(self, file);
+    ok = !ferror(file);
+    ok = !fclose(file) && ok;
+  }
+  if (!ok)
+    perror(source);
+  else if (snprintf(command, sizeof(command),
+                    "%s -O1 -shared -fPIC -o '%s' '%s'",
+                    (cc && *cc) ? cc : "cc", library,
+                    source) >= (int)sizeof(command) ||
+           system(command) != 0) {
+    fprintf(stderr, "%s: Failed to compile the netlist\n", self->chip->path);
+    ok = false;
+  } else if ((self->compiled = dlopen(library, RTLD_NOW | RTLD_LOCAL)) ==
+             NULL) {
+    fprintf(stderr, "%s\n", dlerror());
+    ok = false;
+  }
+  unlink(source);
+  unlink(library);
+  rmdir(temp);
+  if (!ok)
+    return false;
+  *(void **)&self->compiledEval = dlsym(self->compiled, "eval");
+  *(void **)&self->compiledTick = dlsym(self->compiled, "tick");
+  *(void **)&self->compiledTock = dlsym(self->compiled, "tock");
+  if (!self->compiledEval || !self->compiledTick || !self->compiledTock) {
+    fprintf(stderr, "%s\n", dlerror());
+    return false;
+  }
+  return true;
+}
+// sweep {{{1
+// declarations {{{2
+#define MAX_MISMATCHES 10
+
+static uint64_t random_next(uint64_t *state) {
+  // xorshift64*
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 2685821657736338717ULL;
+}
+// print_vector {{{2
+static void print_vector(Netlist const *self, unsigned lane, FILE *output) {
+  ChipDef const *chip = self->chip;
+  for (size_t i = 0; i < chip->nInputs + chip->nOutputs; i++)
+    fprintf(output, "%s%s=%d", (i == chip->nInputs) ? " | " : (i) ? " " : "",
+            chip->pins[i].name, netlist_get(self, &chip->pins[i], lane));
+}
+// sweep {{{2
+int sweep(Netlist *netlist, Netlist *reference, uint64_t count,
+          bool exhaustive) {
+  /* Evaluates the chip for every combination of its inputs, or for count
+   * random ones, a lane per combination. Prints the outputs of each, or
+   * only those that differ from a reference chip. Flip-flops keep their
+   * initial state. */
+  ChipDef const *chip = netlist->chip;
+  size_t nPins = chip->nInputs + chip->nOutputs;
+  unsigned nInputBits = (chip->nOutputs) ? chip->pins[chip->nInputs].offset
+                                         : chip->nBits;
+  Pin const **other = calloc(nPins + 1, sizeof(Pin *));
+  if (other == NULL) {
+    perror("Failed to allocate memory!");
+    return EXIT_FAILURE;
+  }
+  for (size_t i = 0; reference && i < nPins; i++) {
+    other[i] = chip_pin(reference->chip, chip->pins[i].name);
+    if (other[i] == NULL || other[i]->width != chip->pins[i].width ||
+        (other[i] < reference->chip->pins + reference->chip->nInputs) !=
+            (i < chip->nInputs) ||
+        nPins != reference->chip->nInputs + reference->chip->nOutputs) {
+      fprintf(stderr, "%s and %s differ in their pins\n", chip->path,
+              reference->chip->path);
+      free(other);
+      return EXIT_FAILURE;
+    }
+  }
+  if (exhaustive) {
+    if (nInputBits > 40) {
+      fprintf(stderr, "%s has too many inputs to try them all\n", chip->name);
+      free(other);
+      return EXIT_FAILURE;
+    }
+    count = (uint64_t)1 << nInputBits;
+  }
+
+  // Lane l of the i-th input bit of an exhaustive sweep is bit i of l
+  Value pattern[16] = {0};
+  unsigned laneBits = 0;
+  while ((1U << laneBits) < LANES)
+    laneBits++;
+  for (unsigned i = 0; i < laneBits; i++) {
+    for (unsigned lane = 0; lane < LANES; lane++)
+      lane_set(&pattern[i], lane, lane >> i & 1);
+  }
+
+  netlist->lanes = LANES;
+  if (reference)
+    reference->lanes = LANES;
+  uint64_t seed = 1, mismatches = 0;
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (uint64_t base = 0; base < count; base += LANES) {
+    unsigned lanes = (count - base < LANES) ? count - base : LANES;
+    for (size_t i = 0; i < chip->nInputs; i++) {
+      Pin const *pin = &chip->pins[i];
+      for (unsigned bit = 0; bit < pin->width; bit++) {
+        unsigned index = pin->offset + bit;
+        Value value;
+        if (!exhaustive) {
+          for (unsigned word = 0; word < LANES / 64; word++)
+            ((LaneWord *)&value)[word] = random_next(&seed);
+        } else if (index < laneBits)
+          value = pattern[index];
+        else
+          value = (base >> index & 1) ? ALL_LANES : (Value){0};
+        netlist->values[netlist->pins[index]] = value;
+        if (reference)
+          reference->values[reference->pins[other[i]->offset + bit]] = value;
+      }
+    }
+    netlist_eval(netlist);
+    if (reference == NULL) {
+      for (unsigned lane = 0; lane < lanes; lane++) {
+        print_vector(netlist, lane, stdout);
+        putchar('\n');
+      }
+      continue;
+    }
+    netlist_eval(reference);
+    Value diff = {0};
+    for (size_t i = chip->nInputs; i < nPins; i++) {
+      for (unsigned bit = 0; bit < chip->pins[i].width; bit++)
+        diff |= netlist->values[netlist->pins[chip->pins[i].offset + bit]] ^
+                reference->values[reference->pins[other[i]->offset + bit]];
+    }
+    for (unsigned lane = 0; lane < lanes; lane++) {
+      if (!lane_get(&diff, lane))
+        continue;
+      if (mismatches++ < MAX_MISMATCHES) {
+        print_vector(netlist, lane, stdout);
+        printf(", expected");
+        for (size_t i = chip->nInputs; i < nPins; i++)
+          printf(" %s=%d", other[i]->name,
+                 netlist_get(reference, other[i], lane));
+        putchar('\n');
+      }
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double ms = (end.tv_sec - start.tv_sec) * 1e3 +
+              (end.tv_nsec - start.tv_nsec) / 1e6;
+  fprintf(stderr, "%llu vectors in %.3f ms, %d lanes",
+          (unsigned long long)count, ms, LANES);
+  if (reference)
+    fprintf(stderr, ", %llu mismatches", (unsigned long long)mismatches);
+  fputc('\n', stderr);
+  free(other);
+  return (mismatches) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+// read_vectors {{{1
+int read_vectors(Netlist *netlist, FILE *input) {
+  /* Reads lines of 'pin=value', 'tick' and 'tock' and prints the outputs
+   * after each */
+  ChipDef const *chip = netlist->chip;
+  int status = EXIT_SUCCESS;
+  char line[MAX_LINE_LENGTH];
+  char name[MAX_TOKEN_LENGTH];
+  netlist_eval(netlist);
+  while (fgets(line, sizeof(line), input)) {
+    char *c = line;
+    for (int length, value; sscanf(c, " %63s%n", name, &length) == 1;
+         c += length) {
+      char *equals = strchr(name, '=');
+      if (!strcmp(name, "tick")) {
+        netlist_tick(netlist);
+        continue;
+      }
+      if (!strcmp(name, "tock")) {
+        netlist_tock(netlist);
+        continue;
+      }
+      Pin const *pin = NULL;
+      if (equals) {
+        *equals = '\0';
+        pin = chip_pin(chip, name);
+      }
+      if (pin == NULL || pin >= chip->pins + chip->nInputs ||
+          sscanf(equals + 1, "%d", &value) != 1) {
+        fprintf(stderr, "Invalid input %s\n", name);
+        status = EXIT_FAILURE;
+        continue;
+      }
+      netlist_set(netlist, pin, value);
+    }
+    netlist_eval(netlist);
+    for (size_t i = chip->nInputs; i < chip->nInputs + chip->nOutputs; i++)
+      printf("%s=%d%c", chip->pins[i].name,
+             netlist_get(netlist, &chip->pins[i], 0),
+             (i + 1 < chip->nInputs + chip->nOutputs) ? ' ' : '\n');
+  }
+  return status;
+}
+// report {{{1
+// declarations {{{2
+#define MAX_HOTSPOTS 10
+
+typedef struct {
+  ChipDef *chip;
+  size_t nands; // In one of it
+  size_t flops;
+  size_t uses; // In the whole design
+} ChipCount;
+typedef struct {
+  Library *library;
+  ChipCount *counts; // Of every chip, after those of its parts
+  size_t length;
+  size_t capacity;
+} Report;
+
+static ChipCount *report_find(Report const *self, ChipDef const *chip) {
+  for (size_t i = 0; i < self->length; i++) {
+    if (self->counts[i].chip == chip)
+      return &self->counts[i];
+  }
+  return NULL;
+}
+
+static int count_compare(void const *a, void const *b) {
+  // Most Nand gates in the whole design first
+  ChipCount const *x = a, *y = b;
+  size_t nx = x->nands * x->uses, ny = y->nands * y->uses;
+  return (nx != ny) ? (nx < ny) - (nx > ny) : strcmp(x->chip->name,
+                                                     y->chip->name);
+}
+// report_count {{{2
+static bool report_count(Report *self, ChipDef *chip) {
+  // Counts the Nand gates and flip-flops of a chip, then of its parts
+  if (report_find(self, chip))
+    return true;
+  if (chip->flattening) {
+    fprintf(stderr, "%s: %s is made of itself\n", chip->path, chip->name);
+    return false;
+  }
+  ChipCount count = {chip, chip->builtin == NAND, chip->builtin == DFF, 0};
+  bool ok = true;
+  chip->flattening = true;
+  for (size_t i = 0; ok && !chip->builtin && i < chip->nParts; i++) {
+    Part *part = &chip->parts[i];
+    if (part->def == NULL &&
+        (part->def = library_find(self->library, part->chip)) == NULL) {
+      fprintf(stderr, "%s:%zu: In %s\n", chip->path, part->line, chip->name);
+      ok = false;
+    } else if ((ok = report_count(self, part->def))) {
+      ChipCount const *sub = report_find(self, part->def);
+      count.nands += sub->nands;
+      count.flops += sub->flops;
+    }
+  }
+  chip->flattening = false;
+  if (ok && (ok = grow(&self->counts, &self->capacity, self->length,
+                       sizeof(ChipCount))))
+    self->counts[self->length++] = count;
+  return ok;
+}
+// report_part {{{2
+static void report_part(Netlist const *self, uint32_t part, FILE *output) {
+  // Prints the parts near the top a part is in, like CPU/ALU
+  if (part == NO_PROBE) {
+    fputs(self->chip->name, output);
+    return;
+  }
+  if (self->probes[part].parent != NO_PROBE) {
+    report_part(self, self->probes[part].parent, output);
+    fputc('/', output);
+  }
+  fputs(self->probes[part].name, output);
+}
+static bool part_same(Netlist const *self, uint32_t a, uint32_t b) {
+  // Whether two parts are instances of the same chips down from the top
+  if (a == b)
+    return true;
+  if (a == NO_PROBE || b == NO_PROBE)
+    return false;
+  return !strcmp(self->probes[a].name, self->probes[b].name) &&
+         part_same(self, self->probes[a].parent, self->probes[b].parent);
+}
+// report_net {{{2
+static void report_net(Netlist const *self, uint32_t const *driver,
+                       uint32_t net, FILE *output) {
+  // Names a net after a pin, the out pin of a part or what drives it
+  ChipDef const *chip = self->chip;
+  for (size_t i = 0; i < chip->nInputs + chip->nOutputs; i++) {
+    Pin const *pin = &chip->pins[i];
+    for (unsigned bit = 0; bit < pin->width; bit++) {
+      if (self->pins[pin->offset + bit] != net)
+        continue;
+      if (pin->width > 1)
+        fprintf(output, "%s[%u]", pin->name, bit);
+      else
+        fputs(pin->name, output);
+      return;
+    }
+  }
+  for (size_t i = 0; i < self->nProbes; i++) {
+    Probe const *probe = &self->probes[i];
+    for (unsigned bit = 0; bit < probe->width; bit++) {
+      if (probe->out[bit] != net)
+        continue;
+      report_part(self, i, output);
+      if (probe->width > 1)
+        fprintf(output, ".out[%u]", bit);
+      else
+        fputs(".out", output);
+      return;
+    }
+  }
+  if (driver[net] != NO_CELL) {
+    fputs("a gate in ", output);
+    report_part(self, self->cells[driver[net]].part, output);
+    return;
+  }
+  for (size_t i = 0; i < self->nFlops; i++) {
+    if (self->flops[i].out == net) {
+      fputs("a DFF in ", output);
+      report_part(self, self->flops[i].part, output);
+      return;
+    }
+  }
+  fputs((net == NET_TRUE) ? "true" : "false", output);
+}
+// report_path {{{2
+static bool report_path(Netlist const *self, uint32_t const *driver,
+                        FILE *output) {
+  /* Prints the longest path between inputs or flip-flops and outputs or
+   * flip-flops, as the levels it spends in each of the parts near the top
+   * it goes through */
+  if (self->nCells == 0)
+    return true;
+  uint32_t *path = malloc(self->nLevels * sizeof(uint32_t));
+  if (path == NULL) {
+    perror("Failed to allocate memory!");
+    return false;
+  }
+  // The cells are sorted by level, the last is on a longest path
+  uint32_t nets[MAX_CELL_NETS];
+  size_t length = 0;
+  path[length++] = self->nCells - 1;
+  while (self->cells[path[length - 1]].level > 1) {
+    Cell const *cell = &self->cells[path[length - 1]];
+    unsigned nInputs = cell_inputs(self, cell, nets);
+    for (unsigned i = 0; i < nInputs; i++) {
+      uint32_t d = driver[nets[i]];
+      if (d != NO_CELL && self->cells[d].level == cell->level - 1) {
+        path[length++] = d;
+        break;
+      }
+    }
+  }
+  Cell const *first = &self->cells[path[length - 1]];
+  unsigned nInputs = cell_inputs(self, first, nets);
+  uint32_t from = nets[0];
+  for (unsigned i = 0; i < nInputs && from <= NET_TRUE; i++)
+    from = nets[i];
+  cell_outputs(self, &self->cells[path[0]], nets);
+  fprintf(output, "Longest path: %zu levels, from ", self->nLevels);
+  report_net(self, driver, from, output);
+  fputs(" to ", output);
+  size_t flop = 0;
+  while (flop < self->nFlops && self->flops[flop].in != nets[0])
+    flop++;
+  if (flop < self->nFlops) {
+    fputs("a DFF in ", output);
+    report_part(self, self->flops[flop].part, output);
+  } else
+    report_net(self, driver, nets[0], output);
+  fputc('\n', output);
+  // A line for the levels spent in the instances of the same part in turn
+  uint32_t start = 1;
+  unsigned nInstances = 0;
+  for (size_t i = length; i--;) {
+    uint32_t part = self->cells[path[i]].part;
+    nInstances += i + 1 == length || self->cells[path[i + 1]].part != part;
+    if (i && part_same(self, self->cells[path[i - 1]].part, part))
+      continue;
+    fprintf(output, "  %5u-%-5u ", start, self->cells[path[i]].level);
+    report_part(self, part, output);
+    if (nInstances > 1)
+      fprintf(output, " x%u", nInstances);
+    fputc('\n', output);
+    start = self->cells[path[i]].level + 1;
+    nInstances = 0;
+  }
+  free(path);
+  return true;
+}
+// report_fanout {{{2
+static bool report_fanout(Netlist const *self, uint32_t const *driver,
+                          FILE *output) {
+  // Prints the nets read by the most cells, flip-flops and memories
+  uint32_t *fanout = calloc(self->nNets, sizeof(uint32_t));
+  if (fanout == NULL) {
+    perror("Failed to allocate memory!");
+    return false;
+  }
+  uint32_t nets[MAX_CELL_NETS];
+  for (size_t i = 0; i < self->nCells; i++) {
+    unsigned nInputs = cell_inputs(self, &self->cells[i], nets);
+    for (unsigned j = 0; j < nInputs; j++) {
+      bool seen = false;
+      for (unsigned k = 0; !seen && k < j; k++)
+        seen = nets[k] == nets[j];
+      fanout[nets[j]] += !seen;
+    }
+  }
+  for (size_t i = 0; i < self->nFlops; i++)
+    fanout[self->flops[i].in]++;
+  for (size_t i = 0; i < self->nMemories; i++) {
+    Memory const *memory = &self->memories[i];
+    for (unsigned bit = 0; memory->load != NET_FALSE && bit < MAX_BUS_WIDTH;
+         bit++)
+      fanout[memory->in[bit]]++;
+    fanout[memory->load]++;
+  }
+  fanout[NET_FALSE] = fanout[NET_TRUE] = 0;
+  fputs("Fan-out:\n", output);
+  for (unsigned i = 0; i < MAX_HOTSPOTS; i++) {
+    uint32_t max = NET_FALSE;
+    for (size_t net = 0; net < self->nNets; net++) {
+      if (fanout[net] > fanout[max])
+        max = net;
+    }
+    if (fanout[max] == 0)
+      break;
+    fprintf(output, "  %6u  ", fanout[max]);
+    report_net(self, driver, max, output);
+    fputc('\n', output);
+    fanout[max] = 0;
+  }
+  free(fanout);
+  return true;
+}
+// report {{{2
+int report(Netlist *netlist, Library *library) {
+  /* Prints the Nand gates and flip-flops of every chip the design is made
+   * of, its longest combinational path and the nets with the most fan-out */
+  Report self = {.library = library};
+  uint32_t *driver = malloc(netlist->nNets * sizeof(uint32_t));
+  if (driver == NULL) {
+    perror("Failed to allocate memory!");
+    return EXIT_FAILURE;
+  }
+  bool ok = report_count(&self, netlist->chip);
+  if (ok) {
+    // Parts come before the chips made of them, so use them the other way
+    self.counts[self.length - 1].uses = 1;
+    for (size_t i = self.length; i--;) {
+      ChipDef const *chip = self.counts[i].chip;
+      for (size_t j = 0; !chip->builtin && j < chip->nParts; j++)
+        report_find(&self, chip->parts[j].def)->uses += self.counts[i].uses;
+    }
+    qsort(self.counts, self.length, sizeof(ChipCount), count_compare);
+    printf("%-16s %8s %8s %8s %12s %10s\n", "Chip", "Uses", "Nands", "DFFs",
+           "Total nands", "Total DFFs");
+    for (size_t i = 0; i < self.length; i++) {
+      ChipCount const *count = &self.counts[i];
+      printf("%-16s %8zu %8zu %8zu %12zu %10zu\n", count->chip->name,
+             count->uses, count->nands, count->flops,
+             count->nands * count->uses, count->flops * count->uses);
+    }
+  }
+  for (size_t i = 0; ok && i < netlist->nNets; i++)
+    driver[i] = NO_CELL;
+  uint32_t nets[MAX_CELL_NETS];
+  for (size_t i = 0; ok && i < netlist->nCells; i++) {
+    unsigned nOutputs = cell_outputs(netlist, &netlist->cells[i], nets);
+    for (unsigned j = 0; j < nOutputs; j++)
+      driver[nets[j]] = i;
+  }
+  if (ok) {
+    driver[NET_FALSE] = driver[NET_TRUE] = NO_CELL;
+    ok = report_path(netlist, driver, stdout) &&
+         report_fanout(netlist, driver, stdout);
+  }
+  free(driver);
+  free(self.counts);
+  return (ok) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+// test scripts {{{1
+// declarations {{{2
+#define MAX_COLUMNS 64
+#define MAX_LOOPS 16
+#define ROM_SIZE 32768U
+#define RAM_SIZE 32768U
+#define HACK_EXT ".hack"
+
+typedef struct {
+  uint16_t rom[ROM_SIZE];
+  int16_t ram[RAM_SIZE];
+  int16_t a;
+  int16_t d;
+  uint16_t pc;
+  // What the last instruction put on the bus of the memory
+  bool writeM;
+  uint16_t addressM;
+  int16_t outM;
+} Machine; // The CPU emulator of the assembly scripts
+
+typedef enum {
+  VAR_TIME,
+  VAR_PIN,    // Of the chip
+  VAR_PROBE,  // Output of a part, like PC[]
+  VAR_MEMORY, // Word of a memory, like RAM16K[3]
+  VAR_RAM,    // Of the CPU emulator, like RAM[0]
+  VAR_A,
+  VAR_D,
+  VAR_PC,
+} VarKind;
+typedef struct {
+  VarKind kind;
+  size_t index; // Of the pin, probe or memory
+  unsigned address;
+} Var;
+typedef struct {
+  char name[MAX_TOKEN_LENGTH]; // As in the header
+  Var var;
+  char format; // B, D, X or S
+  unsigned padLeft, length, padRight;
+} Column;
+typedef struct {
+  size_t pos; // Of the body, or of the while
+  size_t line;
+  long remaining; // Repetitions, -1 forever, -2 for a while
+} Loop;
+typedef struct {
+  char const *path;
+  char *log; // Everything the script printed
+  size_t logSize;
+  bool failed;
+  size_t compared; // Lines
+} Job;
+typedef struct {
+  Job *jobs;
+  size_t length;
+  size_t next; // First job no worker has taken yet
+  Library const *library;
+  bool optimize;
+  bool rams;
+  bool events;
+} Tests;
+typedef struct {
+  Tests const *tests;
+  Job *job;
+  FILE *log;
+  char dir[PATH_MAX];
+  char *text; // Of the script
+  size_t pos;
+  size_t line;
+  Loop loops[MAX_LOOPS];
+  size_t nLoops;
+  // What runs it
+  Library library;
+  Netlist *netlist;
+  Machine *machine;
+  uint64_t time;
+  bool ticked; // Half a cycle ahead of time
+  // Its results
+  Column columns[MAX_COLUMNS];
+  size_t nColumns;
+  FILE *output;
+  FILE *compare;
+  char const *error;   // Stops the script
+  char const *subject; // Of the error
+} Test;
+// machine_load {{{2
+static bool machine_load(Machine *self, char const *path) {
+  // Reads a .hack file, one instruction of 16 binary digits per line
+  char line[MAX_LINE_LENGTH];
+  FILE *file = fopen(path, "r");
+  if (file == NULL)
+    return false;
+  memset(self, 0, sizeof(Machine));
+  size_t length = 0;
+  bool ok = true;
+  while (ok && fgets(line, sizeof(line), file)) {
+    if (strspn(line, " \t\r\n") == strlen(line))
+      continue;
+    ok = strspn(line, "01") == 16 && length < ROM_SIZE;
+    if (ok)
+      self->rom[length++] = (uint16_t)strtoul(line, NULL, 2);
+  }
+  fclose(file);
+  return ok;
+}
+// machine_step {{{2
+static void machine_step(Machine *self) {
+  // Executes one instruction
+  uint16_t instr = self->rom[self->pc & (ROM_SIZE - 1)];
+  uint16_t address = (uint16_t)self->a & (RAM_SIZE - 1);
+  self->writeM = false;
+  self->addressM = address;
+  if (!(instr & 0x8000)) {
+    self->a = (int16_t)instr;
+    self->pc++;
+    return;
+  }
+  int16_t x = self->d;
+  int16_t y = (instr & 0x1000) ? self->ram[address] : self->a;
+  if (instr & 0x0800)
+    x = 0;
+  if (instr & 0x0400)
+    x = ~x;
+  if (instr & 0x0200)
+    y = 0;
+  if (instr & 0x0100)
+    y = ~y;
+  int16_t out = (instr & 0x0080) ? (int16_t)(x + y) : (x & y);
+  if (instr & 0x0040)
+    out = ~out;
+  uint16_t target = (uint16_t)self->a & (ROM_SIZE - 1);
+  self->writeM = instr & 0x0008;
+  self->outM = out;
+  if (self->writeM)
+    self->ram[address] = out;
+  if (instr & 0x0020)
+    self->a = out;
+  if (instr & 0x0010)
+    self->d = out;
+  if (((instr & 4) && out < 0) || ((instr & 2) && out == 0) ||
+      ((instr & 1) && out > 0))
+    self->pc = target;
+  else
+    self->pc++;
+}
+// test_token {{{2
+static bool test_token(Test *self, char *token, size_t size) {
+  /* Reads the next word, string or one of ,;!{} of the script, skipping
+   * comments */
+  char const *c = self->text + self->pos;
+  for (;;) {
+    for (; isspace((unsigned char)*c); c++)
+      self->line += *c == '\n';
+    if (c[0] == '/' && c[1] == '/')
+      c += strcspn(c, "\n");
+    else if (c[0] == '/' && c[1] == '*') {
+      char const *end = strstr(c + 2, "*/");
+      for (char const *d = c; d < ((end) ? end : c + strlen(c)); d++)
+        self->line += *d == '\n';
+      c = (end) ? end + 2 : c + strlen(c);
+    } else
+      break;
+  }
+  size_t length = 0;
+  if (*c == '"') {
+    length = strcspn(c + 1, "\"\n") + 2;
+    if (c[length - 1] != '"')
+      length--;
+  } else if (*c && strchr(",;!{}", *c))
+    length = 1;
+  else
+    length = strcspn(c, " \t\r\n,;!{}\"");
+  self->pos = c - self->text + length;
+  if (length >= size)
+    length = size - 1;
+  memcpy(token, c, length);
+  token[length] = '\0';
+  return length > 0;
+}
+// test_skip {{{2
+static void test_skip(Test *self) {
+  // Skips to after the } closing the block just opened
+  char token[MAX_LINE_LENGTH];
+  for (unsigned depth = 1; depth && test_token(self, token, sizeof(token));)
+    depth += (*token == '{') - (*token == '}');
+}
+// test_path {{{2
+static bool test_path(Test *self, char *path, char const *name) {
+  // Relative to the script, fails the script when it does not fit
+  int length;
+  if (*name == '/')
+    length = snprintf(path, PATH_MAX, "%s", name);
+  else
+    length = snprintf(path, PATH_MAX, "%s/%s", self->dir, name);
+  if (length < PATH_MAX)
+    return true;
+  self->error = "Path too long";
+  self->subject = name;
+  return false;
+}
+// test_var {{{2
+static bool test_var(Test *self, char const *name, Var *var) {
+  // Finds what a name of the script stands for, like out, RAM[3] or PC[]
+  char base[MAX_TOKEN_LENGTH];
+  size_t length = strcspn(name, "[");
+  if (length >= sizeof(base))
+    return false;
+  memcpy(base, name, length);
+  base[length] = '\0';
+  bool indexed = name[length] == '[';
+  unsigned address = (indexed) ? strtoul(name + length + 1, NULL, 0) : 0;
+  *var = (Var){.address = address};
+  if (!strcmp(name, "time"))
+    return var->kind = VAR_TIME, true;
+  if (self->machine) {
+    var->kind = (!strcmp(base, "RAM") && indexed) ? VAR_RAM
+                : (!strcmp(name, "A"))            ? VAR_A
+                : (!strcmp(name, "D"))            ? VAR_D
+                : (!strcmp(name, "PC"))           ? VAR_PC
+                                                  : VAR_TIME;
+    return var->kind != VAR_TIME && address < RAM_SIZE;
+  }
+  if (self->netlist == NULL)
+    return false;
+  Netlist const *netlist = self->netlist;
+  ChipDef const *chip = netlist->chip;
+  if (!indexed) {
+    Pin const *pin = chip_pin(chip, name);
+    var->kind = VAR_PIN;
+    var->index = pin - chip->pins;
+    return pin != NULL;
+  }
+  if (name[length + 1] == ']') {
+    for (size_t i = 0; i < netlist->nProbes; i++) {
+      Probe const *probe = &netlist->probes[i];
+      if (probe->width && !strcmp(probe->name, base)) {
+        var->kind = VAR_PROBE;
+        var->index = i;
+        return true;
+      }
+    }
+  }
+  for (size_t i = 0; i < netlist->nMemories; i++) {
+    Memory const *memory = &netlist->memories[i];
+    if (!strcmp(memory->name, base) && address < (1U << memory->width)) {
+      var->kind = VAR_MEMORY;
+      var->index = i;
+      return true;
+    }
+  }
+  return false;
+}
+// test_get {{{2
+static int test_get(Test const *self, Var const *var) {
+  Netlist const *netlist = self->netlist;
+  switch (var->kind) {
+  case VAR_TIME:
+    return (int)self->time;
+  case VAR_PIN:
+    return netlist_get(netlist, &netlist->chip->pins[var->index], 0);
+  case VAR_PROBE:
+    return netlist_probe(netlist, &netlist->probes[var->index], 0);
+  case VAR_MEMORY:
+    return (int16_t)netlist->memories[var->index].words[var->address];
+  case VAR_RAM:
+    return self->machine->ram[var->address];
+  case VAR_A:
+    return self->machine->a;
+  case VAR_D:
+    return self->machine->d;
+  default: // VAR_PC
+    return self->machine->pc;
+  }
+}
+// test_set {{{2
+static bool test_set(Test *self, Var const *var, int value) {
+  Netlist *netlist = self->netlist;
+  switch (var->kind) {
+  case VAR_PIN: {
+    Pin const *pin = &netlist->chip->pins[var->index];
+    if (pin >= netlist->chip->pins + netlist->chip->nInputs)
+      return false;
+    netlist_set(netlist, pin, value);
+    return true;
+  }
+  case VAR_MEMORY: {
+    // Every lane, though the scripts only look at the first
+    Memory *memory = &netlist->memories[var->index];
+    for (unsigned lane = 0; lane < ((memory->stride) ? LANES : 1); lane++)
+      memory->words[lane * memory->stride + var->address] = (uint16_t)value;
+    if (netlist->events)
+      netlist_schedule(netlist, memory->cell);
+    return true;
+  }
+  case VAR_RAM:
+    self->machine->ram[var->address] = (int16_t)value;
+    return true;
+  case VAR_A:
+    self->machine->a = (int16_t)value;
+    return true;
+  case VAR_D:
+    self->machine->d = (int16_t)value;
+    return true;
+  case VAR_PC:
+    self->machine->pc = (uint16_t)value & (ROM_SIZE - 1);
+    return true;
+  default:
+    return false;
+  }
+}
+// test_value {{{2
+static bool test_value(char const *text, int *value) {
+  // Decimal, or %B, %X or %D followed by digits of that base
+  int base = 10;
+  if (*text == '%') {
+    base = (text[1] == 'B') ? 2 : (text[1] == 'X') ? 16 : 10;
+    if (!strchr("BXD", text[1]))
+      return false;
+    text += 2;
+  }
+  char *end;
+  long parsed = strtol(text, &end, base);
+  *value = (int)parsed;
+  return *text && *end == '\0';
+}
+// test_load {{{2
+static bool test_load(Test *self, char const *name) {
+  // A chip for the simulator, or a program for the CPU emulator
+  char path[PATH_MAX];
+  if (!test_path(self, path, name))
+    return false;
+  if (self->netlist)
+    netlist_del(self->netlist);
+  self->netlist = NULL;
+  free(self->machine);
+  self->machine = NULL;
+  self->time = 0;
+  self->ticked = false;
+  char const *ext = strrchr(name, '.');
+  if (ext && !strcmp(ext, HDL_EXT)) {
+    ChipDef *chip = library_load(&self->library, path);
+    if (chip)
+      self->netlist = netlist_new(&self->library, chip, self->tests->optimize,
+                                  self->tests->rams);
+    if (self->netlist && self->tests->events && !netlist_events(self->netlist))
+      return false;
+    return self->netlist != NULL;
+  }
+  // Assembly runs assembled, from the .hack next to it
+  if (ext && !strcmp(ext, ".asm") &&
+      snprintf(path, sizeof(path), "%s/%.*s%s", self->dir, (int)(ext - name),
+               name, HACK_EXT) >= (int)sizeof(path)) {
+    self->error = "Path too long";
+    self->subject = name;
+    return false;
+  }
+  if ((self->machine = malloc(sizeof(Machine))) == NULL) {
+    perror("Failed to allocate memory!");
+    return false;
+  }
+  if (!machine_load(self->machine, path)) {
+    fprintf(self->log, "%s: Missing or invalid, assemble the program\n",
+            path);
+    return false;
+  }
+  return true;
+}
+// test_output_list {{{2
+static bool test_output_list(Test *self, char args[][MAX_TOKEN_LENGTH],
+                             size_t nArgs) {
+  // Columns like out%B1.16.1, the variable, its format and paddings
+  self->nColumns = 0;
+  for (size_t i = 0; i < nArgs && i < MAX_COLUMNS; i++) {
+    Column *column = &self->columns[self->nColumns++];
+    char *format = strchr(args[i], '%');
+    *column = (Column){.format = 'B', .padLeft = 1, .length = 1,
+                       .padRight = 1};
+    if (format) {
+      *format = '\0';
+      if (sscanf(format + 1, "%c%u.%u.%u", &column->format, &column->padLeft,
+                 &column->length, &column->padRight) != 4 ||
+          !strchr("BDXS", column->format) || column->length > 64 ||
+          column->padLeft > 64 || column->padRight > 64)
+        return false;
+    }
+    snprintf(column->name, sizeof(column->name), "%s", args[i]);
+    if (!test_var(self, column->name, &column->var)) {
+      self->subject = args[i];
+      return false;
+    }
+  }
+  return true;
+}
+// test_compare {{{2
+static bool test_compare(Test *self, char const *line) {
+  /* Writes a line of output and compares it with the next expected one,
+   * whose * match any character; spaces don't count */
+  if (self->output)
+    fprintf(self->output, "%s\n", line);
+  if (self->compare == NULL)
+    return true;
+  char expected[MAX_LINE_LENGTH * 4];
+  if (fgets(expected, sizeof(expected), self->compare) == NULL)
+    *expected = '\0';
+  expected[strcspn(expected, "\r\n")] = '\0';
+  char const *e = expected, *o = line;
+  for (;;) {
+    e += strspn(e, " \t");
+    o += strspn(o, " \t");
+    if (!*e || !*o || (*e != '*' && *e != *o))
+      break;
+    e++;
+    o++;
+  }
+  self->job->compared++;
+  if (!*e && !*o)
+    return true;
+  fprintf(self->log, "%s:%zu: Comparison failure at line %zu\n- %s\n+ %s\n",
+          self->job->path, self->line, self->job->compared, expected, line);
+  return false;
+}
+// test_output {{{2
+static bool test_output(Test *self, bool header) {
+  char line[MAX_LINE_LENGTH * 4] = "|";
+  size_t length = 1;
+  for (size_t i = 0; i < self->nColumns; i++) {
+    Column const *column = &self->columns[i];
+    unsigned width = column->padLeft + column->length + column->padRight;
+    char cell[3 * 64 + 2];
+    if (header) {
+      // The name in the middle, cut to the width
+      unsigned nameLength = strlen(column->name);
+      if (nameLength > width)
+        nameLength = width;
+      unsigned left = (width - nameLength) / 2;
+      snprintf(cell, sizeof(cell), "%*s%.*s%*s|", left, "", nameLength,
+               column->name, width - nameLength - left, "");
+    } else {
+      char value[66];
+      int v = test_get(self, &column->var);
+      if (column->format == 'B') {
+        for (unsigned bit = 0; bit < column->length; bit++) {
+          unsigned shift = column->length - 1 - bit;
+          value[bit] = '0' + (v >> ((shift < 31) ? shift : 31) & 1);
+        }
+        value[column->length] = '\0';
+      } else if (column->format == 'X')
+        snprintf(value, sizeof(value), "%0*X", column->length,
+                 (unsigned)v & 0xffffU);
+      else if (column->format == 'S' && column->var.kind == VAR_TIME)
+        snprintf(value, sizeof(value), "%d%s", v, (self->ticked) ? "+" : "");
+      else
+        snprintf(value, sizeof(value), "%d", v);
+      // Strings to the left, numbers to the right
+      snprintf(cell, sizeof(cell), "%*s%*.*s%*s|", column->padLeft, "",
+               (column->format == 'S') ? -(int)column->length
+                                       : (int)column->length,
+               column->length, value, column->padRight, "");
+    }
+    length += snprintf(line + length, sizeof(line) - length, "%s", cell);
+    if (length >= sizeof(line))
+      break;
+  }
+  return test_compare(self, line);
+}
+// test_command {{{2
+static void test_command(Test *self, char const *command,
+                         char args[][MAX_TOKEN_LENGTH], size_t nArgs) {
+  char path[PATH_MAX];
+  bool chip = self->netlist != NULL;
+  Var var;
+  int value;
+  if (!strcmp(command, "load") && nArgs == 1) {
+    if (!test_load(self, args[0]) && !self->error)
+      self->error = "Failed to load";
+  } else if (!strcmp(command, "output-file") && nArgs == 1) {
+    if (!test_path(self, path, args[0]))
+      return;
+    if (self->output)
+      fclose(self->output);
+    if ((self->output = fopen(path, "w")) == NULL)
+      self->error = strerror(errno);
+  } else if (!strcmp(command, "compare-to") && nArgs == 1) {
+    if (!test_path(self, path, args[0]))
+      return;
+    if (self->compare)
+      fclose(self->compare);
+    if ((self->compare = fopen(path, "r")) == NULL)
+      self->error = strerror(errno);
+  } else if (!strcmp(command, "output-list")) {
+    if (!test_output_list(self, args, nArgs))
+      self->error = "Unknown variable or format";
+    else if (!test_output(self, true))
+      self->error = "";
+  } else if (!strcmp(command, "output") && nArgs == 0) {
+    if (!test_output(self, false))
+      self->error = "";
+  } else if (!strcmp(command, "set") && nArgs == 2) {
+    if (!test_var(self, args[0], &var) || !test_value(args[1], &value) ||
+        !test_set(self, &var, value)) {
+      self->error = "Invalid set";
+      self->subject = args[0];
+    }
+  } else if (!strcmp(command, "eval") && nArgs == 0 && chip) {
+    netlist_eval(self->netlist);
+  } else if (!strcmp(command, "tick") && nArgs == 0 && chip) {
+    netlist_tick(self->netlist);
+    self->ticked = true;
+  } else if (!strcmp(command, "tock") && nArgs == 0 && chip) {
+    netlist_tock(self->netlist);
+    self->ticked = false;
+    self->time++;
+  } else if (!strcmp(command, "ticktock") && nArgs == 0) {
+    if (chip) {
+      netlist_tick(self->netlist);
+      netlist_tock(self->netlist);
+    } else if (self->machine)
+      machine_step(self->machine);
+    self->time++;
+  } else if (!strcmp(command, "ROM32K") && nArgs == 2 &&
+             !strcmp(args[0], "load") && chip) {
+    if (test_path(self, path, args[1]) &&
+        !netlist_load_rom(self->netlist, path))
+      self->error = "Failed to load";
+  } else if (!strcmp(command, "echo") || !strcmp(command, "clear-echo")) {
+    for (size_t i = 0; i < nArgs; i++)
+      fprintf(self->log, "%s%s", args[i], (i + 1 < nArgs) ? " " : "\n");
+  } else
+    self->error = "Unknown command";
+}
+// test_condition {{{2
+static bool test_condition(Test *self, char args[][MAX_TOKEN_LENGTH],
+                           bool *holds) {
+  // Like RAM[1] <> 0
+  Var var;
+  int value;
+  if (!test_var(self, args[0], &var) || !test_value(args[2], &value))
+    return false;
+  int v = test_get(self, &var);
+  char const *op = args[1];
+  *holds = (!strcmp(op, "=")) ? v == value
+           : (!strcmp(op, "<>")) ? v != value
+           : (!strcmp(op, "<"))  ? v < value
+           : (!strcmp(op, ">"))  ? v > value
+           : (!strcmp(op, "<=")) ? v <= value
+                                 : v >= value;
+  return !strcmp(op, "=") || !strcmp(op, "<>") || !strcmp(op, "<") ||
+         !strcmp(op, ">") || !strcmp(op, "<=") || !strcmp(op, ">=");
+}
+// test_run {{{2
+static void test_run(Test *self) {
+  /* Interprets the script: commands end with , or ; and repeat or while
+   * loop over a block */
+  char command[MAX_LINE_LENGTH];
+  char token[MAX_LINE_LENGTH];
+  char args[MAX_COLUMNS][MAX_TOKEN_LENGTH];
+  while (!self->error && test_token(self, command, sizeof(command))) {
+    size_t line = self->line;
+    size_t start = self->pos - strlen(command);
+    if (strchr(",;!", *command))
+      continue;
+    if (*command == '}' && self->nLoops) {
+      // Back to the start of the block, or to its while
+      Loop *loop = &self->loops[self->nLoops - 1];
+      bool again = loop->remaining < 0 || --loop->remaining > 0;
+      if (again) {
+        self->pos = loop->pos;
+        self->line = loop->line;
+      }
+      if (!again || loop->remaining == -2)
+        self->nLoops--;
+      continue;
+    }
+    size_t nArgs = 0;
+    *token = '\0';
+    while (*command != '}' && test_token(self, token, sizeof(token)) &&
+           !strchr(",;!{}", *token)) {
+      if (nArgs < MAX_COLUMNS)
+        snprintf(args[nArgs++], MAX_TOKEN_LENGTH, "%s", token);
+    }
+    bool loop = !strcmp(command, "repeat") || !strcmp(command, "while");
+    bool holds = true;
+    long count = -1;
+    if (*command == '}' || (*token == '{' && !loop))
+      self->error = "Unexpected brace";
+    else if (loop && (*token != '{' || self->nLoops == MAX_LOOPS ||
+                      (*command == 'r' && nArgs > 1) ||
+                      (*command == 'w' &&
+                       (nArgs != 3 || !test_condition(self, args, &holds)))))
+      self->error = "Invalid loop";
+    else if (loop) {
+      if (*command == 'r' && nArgs == 1)
+        holds = (count = strtol(args[0], NULL, 10)) > 0;
+      if (!holds)
+        test_skip(self);
+      else if (*command == 'w')
+        self->loops[self->nLoops++] = (Loop){start, line, -2};
+      else
+        self->loops[self->nLoops++] = (Loop){self->pos, self->line, count};
+    } else {
+      // A block may end without a last separator
+      if (*token == '}')
+        self->pos--;
+      test_command(self, command, args, nArgs);
+    }
+    if (self->error && *self->error)
+      fprintf(self->log, "%s:%zu: %s: %s\n", self->job->path, line,
+              self->error, (self->subject) ? self->subject : command);
+  }
+}
+// test_job {{{2
+static void test_job(Tests const *tests, Job *job) {
+  Test *self = calloc(1, sizeof(Test));
+  FILE *log = open_memstream(&job->log, &job->logSize);
+  FILE *file = fopen(job->path, "r");
+  if (!self || !log || !file) {
+    perror(job->path);
+    job->failed = true;
+    free(self);
+    if (log)
+      fclose(log);
+    if (file)
+      fclose(file);
+    return;
+  }
+  *self = (Test){.tests = tests, .job = job, .log = log, .line = 1};
+  memcpy(self->library.dirs, tests->library->dirs, sizeof(self->library.dirs));
+  self->library.nDirs = tests->library->nDirs;
+  char const *slash = strrchr(job->path, '/');
+  snprintf(self->dir, sizeof(self->dir), "%.*s",
+           (slash) ? (int)(slash - job->path) : 1, (slash) ? job->path : ".");
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  rewind(file);
+  if (size < 0 || (self->text = malloc(size + 1)) == NULL ||
+      fread(self->text, 1, size, file) != (size_t)size) {
+    perror(job->path);
+    self->error = "";
+  } else
+    self->text[size] = '\0';
+  fclose(file);
+  if (!self->error)
+    test_run(self);
+  job->failed = self->error != NULL;
+  fclose(log);
+  if (self->output)
+    fclose(self->output);
+  if (self->compare)
+    fclose(self->compare);
+  if (self->netlist)
+    netlist_del(self->netlist);
+  free(self->machine);
+  free(self->text);
+  library_del(&self->library);
+  free(self);
+}
+// test_worker {{{2
+static void *test_worker(void *arg) {
+  Tests *tests = arg;
+  for (size_t i; (i = __atomic_fetch_add(&tests->next, 1, __ATOMIC_RELAXED)) <
+                 tests->length;)
+    test_job(tests, &tests->jobs[i]);
+  return NULL;
+}
+// test_scripts {{{2
+int test_scripts(Tests *tests, long nThreads) {
+  /* Runs the scripts on a pool of threads, each stopping at its first line
+   * differing from its compare file, then lists their outcomes in order */
+  if (nThreads < 1)
+    nThreads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (nThreads < 1)
+    nThreads = 1;
+  if ((size_t)nThreads > tests->length)
+    nThreads = tests->length;
+  pthread_t *threads = malloc(nThreads * sizeof(pthread_t));
+  if (threads == NULL) {
+    perror("Failed to allocate memory!");
+    return EXIT_FAILURE;
+  }
+  long started = 0;
+  for (; started < nThreads; started++) {
+    if (pthread_create(&threads[started], NULL, test_worker, tests))
+      break;
+  }
+  if (started == 0)
+    test_worker(tests);
+  for (long i = 0; i < started; i++)
+    pthread_join(threads[i], NULL);
+  free(threads);
+
+  int status = EXIT_SUCCESS;
+  size_t nFailed = 0;
+  for (size_t i = 0; i < tests->length; i++) {
+    Job *job = &tests->jobs[i];
+    if (job->log)
+      fwrite(job->log, 1, job->logSize, stdout);
+    printf("%s: %s, %zu lines compared\n", job->path,
+           (job->failed) ? "FAILED" : "passed", job->compared);
+    nFailed += job->failed;
+    free(job->log);
+  }
+  if (nFailed) {
+    printf("%zu of %zu scripts failed\n", nFailed, tests->length);
+    status = EXIT_FAILURE;
+  }
+  return status;
+}
+// co-simulation {{{1
+// declarations {{{2
+typedef struct {
+  char const *name;
+  int chip;     // What the netlist has
+  int emulator; // What the CPU emulator has
+} Difference;
+
+static Probe const *probe_find(Probe const *probes, size_t length,
+                               char const *name) {
+  for (size_t i = 0; i < length; i++) {
+    if (probes[i].width && !strcmp(probes[i].name, name))
+      return &probes[i];
+  }
+  return NULL;
+}
+// cosim_step {{{2
+static bool cosim_step(Netlist *netlist, Machine *machine,
+                       Probe const *const *probes, Difference *difference) {
+  /* Runs a cycle of both, comparing what goes to the memory, then the
+   * registers. The probes are writeM, addressM, outM, ARegister, DRegister
+   * and PC. */
+  int writeM = netlist_probe(netlist, probes[0], 0);
+  int addressM = netlist_probe(netlist, probes[1], 0);
+  int outM = netlist_probe(netlist, probes[2], 0);
+  machine_step(machine);
+  if (writeM != machine->writeM)
+    *difference = (Difference){"writeM", writeM, machine->writeM};
+  else if (addressM != machine->addressM)
+    *difference = (Difference){"addressM", addressM, machine->addressM};
+  else if (writeM && outM != machine->outM)
+    *difference = (Difference){"outM", outM, machine->outM};
+  if (difference->name)
+    return false;
+  netlist_tick(netlist);
+  netlist_tock(netlist);
+  int a = netlist_probe(netlist, probes[3], 0);
+  int d = netlist_probe(netlist, probes[4], 0);
+  uint16_t pc = netlist_probe(netlist, probes[5], 0);
+  if (a != machine->a)
+    *difference = (Difference){"A", a, machine->a};
+  else if (d != machine->d)
+    *difference = (Difference){"D", d, machine->d};
+  else if (pc != machine->pc)
+    *difference = (Difference){"PC", pc, machine->pc};
+  return difference->name == NULL;
+}
+// cosim {{{2
+int cosim(Netlist *netlist, char const *rom, uint64_t cycles) {
+  /* Runs a computer and the CPU emulator of the test scripts side by side
+   * on the program in its ROM, and stops at the first cycle they differ */
+  static char const *const names[] = {"writeM",    "addressM",  "outM",
+                                      "ARegister", "DRegister", "PC"};
+  Probe const *probes[6];
+  for (size_t i = 0; i < 6; i++) {
+    probes[i] = (i < 3) ? probe_find(netlist->wires, netlist->nWires, names[i])
+                        : probe_find(netlist->probes, netlist->nProbes,
+                                     names[i]);
+    if (probes[i] == NULL) {
+      fprintf(stderr, "%s: No %s to compare\n", netlist->chip->path,
+              names[i]);
+      return EXIT_FAILURE;
+    }
+  }
+  Machine *machine = malloc(sizeof(Machine));
+  if (machine == NULL) {
+    perror("Failed to allocate memory!");
+    return EXIT_FAILURE;
+  }
+  if (!machine_load(machine, rom)) {
+    fprintf(stderr, "%s: Invalid program\n", rom);
+    free(machine);
+    return EXIT_FAILURE;
+  }
+  Pin const *reset = chip_pin(netlist->chip, "reset");
+  if (reset)
+    netlist_set(netlist, reset, 0);
+  netlist_eval(netlist);
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  Difference difference = {0};
+  uint64_t cycle = 0;
+  uint16_t pc = 0;
+  while (cycle < cycles) {
+    pc = machine->pc;
+    cycle++;
+    if (!cosim_step(netlist, machine, probes, &difference))
+      break;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double ms = (end.tv_sec - start.tv_sec) * 1e3 +
+              (end.tv_nsec - start.tv_nsec) / 1e6;
+  if (difference.name) {
+    uint16_t instr = machine->rom[pc & (ROM_SIZE - 1)];
+    printf("Cycle %llu, pc %u, instruction ", (unsigned long long)cycle, pc);
+    for (int bit = 15; bit >= 0; bit--)
+      putchar('0' + (instr >> bit & 1));
+    printf(": %s is %d, the emulator has %d\n", difference.name,
+           difference.chip, difference.emulator);
+  }
+  fprintf(stderr, "%llu cycles in %.3f ms, %s\n", (unsigned long long)cycle,
+          ms, (difference.name) ? "differing" : "no difference");
+  free(machine);
+  return (difference.name) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+// main {{{1
+int main(int argc, char *argv[]) {
+  Library library = {0};
+  Library other = {0};         // Of the reference chip
+  char const *rom = NULL;      // Program of the ROM32K chips
+  char const *expected = NULL; // Chip the sweep compares with
+  bool exhaustive = false;     // Sweep every combination of the inputs
+  uint64_t count = 0;          // Random vectors to sweep
+  bool optimize = false;       // Lower to gates and words
+  bool rams = false;           // Simulate RAM chips as arrays
+  bool events = false;         // Evaluate only what changed
+  bool scripts = false;        // Run the test scripts given
+  long nThreads = 0;           // Running them, 0 for every core
+  bool analyze = false;        // Report the gates, paths and fan-out
+  uint64_t cycles = 0;         // Compared with the CPU emulator
+  bool compile = false;        // Into C the system compiler builds
+  for (int opt; (opt = getopt(argc, argv, "I:r:xR:e:OMEtj:ac:C")) != -1;) {
+    switch (opt) {
+    case 'I':
+      if (library.nDirs < MAX_DIRS)
+        library.dirs[library.nDirs++] = optarg;
+      break;
+    case 'r':
+      rom = optarg;
+      break;
+    case 'x':
+      exhaustive = true;
+      break;
+    case 'R':
+      count = strtoull(optarg, NULL, 10);
+      break;
+    case 'e':
+      expected = optarg;
+      break;
+    case 'O':
+      optimize = true;
+      break;
+    case 'M':
+      rams = true;
+      break;
+    case 'E':
+      events = true;
+      break;
+    case 't':
+      scripts = true;
+      break;
+    case 'j':
+      nThreads = strtol(optarg, NULL, 10);
+      break;
+    case 'a':
+      analyze = true;
+      break;
+    case 'c':
+      cycles = strtoull(optarg, NULL, 10);
+      break;
+    case 'C':
+      compile = true;
+      break;
+    default:
+      optind = argc;
+    }
+  }
+  if (scripts && optind < argc) {
+    Tests tests = {.jobs = calloc(argc - optind, sizeof(Job)),
+                   .length = argc - optind,
+                   .library = &library,
+                   .optimize = optimize,
+                   .rams = rams,
+                   .events = events};
+    if (tests.jobs == NULL) {
+      perror("Failed to allocate memory!");
+      return EXIT_FAILURE;
+    }
+    for (int i = optind; i < argc; i++)
+      tests.jobs[i - optind].path = argv[i];
+    int status = test_scripts(&tests, nThreads);
+    free(tests.jobs);
+    return status;
+  }
+  if (scripts || optind != argc - 1 || (expected && !exhaustive && !count) ||
+      (analyze && (exhaustive || count)) || (cycles && !rom) ||
+      (compile && (events || scripts || analyze))) {
+    fprintf(stderr,
+            "Usage: %s [-I <dir>]... [-OM] [-E|-C] [-r <file.hack>] "
+            "<Chip.hdl>\n",
+            argv[0]);
+    fprintf(stderr, "       %s [-I <dir>]... [-OMC] -x|-R <count> "
+                    "[-e <Chip.hdl>] <Chip.hdl>\n",
+            argv[0]);
+    fprintf(stderr, "       %s [-I <dir>]... [-OME] [-j <threads>] -t "
+                    "<script.tst>...\n",
+            argv[0]);
+    fprintf(stderr, "       %s [-I <dir>]... [-OM] -a <Chip.hdl>\n", argv[0]);
+    fprintf(stderr,
+            "       %s [-I <dir>]... [-OM] [-E|-C] -r <file.hack> -c <cycles> "
+            "<Computer.hdl>\n",
+            argv[0]);
+    fprintf(stderr,
+            "Reads lines of 'pin=value', 'tick' and 'tock' and prints the "
+            "outputs after each,\nor sweeps every or random inputs, compared "
+            "with a reference chip, or runs test\nscripts against chips or "
+            "assembled programs, or reports the Nand gates and\nflip-flops "
+            "of every chip, the longest path in gate delays and the nets "
+            "with\nthe most fan-out, or runs a computer against the CPU "
+            "emulator until they differ.\n-O lowers small chips to gates and "
+            "buses of them to words, -M simulates RAM chips\nas arrays, -E "
+            "evaluates only the gates whose inputs changed, and -C compiles "
+            "the\nchip to C with $CC\n");
+    return EXIT_FAILURE;
+  }
+
+  memcpy(other.dirs, library.dirs, sizeof(library.dirs));
+  other.nDirs = library.nDirs;
+  Netlist *netlist = NULL, *reference = NULL;
+  ChipDef *chip = library_load(&library, argv[optind]);
+  if (chip)
+    netlist = netlist_new(&library, chip, optimize, rams);
+  // The reference stays made of Nand gates, to check the optimization too
+  if (netlist && expected && (chip = library_load(&other, expected)))
+    reference = netlist_new(&other, chip, false, false);
+  int status = EXIT_FAILURE;
+  if (netlist && (!expected || reference) &&
+      (!rom || netlist_load_rom(netlist, rom))) {
+    size_t nNands = 0, nGates = 0;
+    for (size_t i = 0; i < netlist->nCells; i++) {
+      nNands += netlist->cells[i].op == OP_NAND;
+      nGates += netlist->cells[i].op != OP_NAND &&
+                netlist->cells[i].op != OP_WORD &&
+                netlist->cells[i].op != OP_MEMORY;
+    }
+    fprintf(stderr, "%s: %zu nands, %zu gates, %zu words, %zu flip-flops, "
+                    "%zu memories, %zu levels\n",
+            netlist->chip->name, nNands, nGates, netlist->nWords,
+            netlist->nFlops, netlist->nMemories, netlist->nLevels);
+    if (analyze)
+      status = report(netlist, &library);
+    else if (compile && !netlist_compile(netlist))
+      status = EXIT_FAILURE;
+    else if (exhaustive || count)
+      status = sweep(netlist, reference, count, exhaustive);
+    else if (events && !netlist_events(netlist))
+      status = EXIT_FAILURE;
+    else if (cycles)
+      status = cosim(netlist, rom, cycles);
+    else
+      status = read_vectors(netlist, stdin);
+  }
+  if (netlist)
+    netlist_del(netlist);
+  if (reference)
+    netlist_del(reference);
+  library_del(&library);
+  library_del(&other);
+  return status;
+}
@@ -0,0 +1,45 @@
+#!/bin/sh
+# A function without locals has no prologue, so a loop at the top of its body
+# shares the address of its entry. The profiler must count jumps back to the
+# loop as iterations, not calls.
+set -e
+src=$(cd "$(dirname "$0")/.." && pwd)
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+for tool in compiler translator assembler emulator; do
+  cc -O2 -w -pthread -o "$dir/$tool" "$src/$tool.c"
+done
+mkdir "$dir/loop"
+cat >"$dir/loop/Sys.jack" <<'JACK'
+class Sys {
+    function void init() {
+        do Main.spin();
+        while (true) {
+        }
+        return;
+    }
+}
+JACK
+cat >"$dir/loop/Main.jack" <<'JACK'
+class Main {
+    static int n;
+
+    function void spin() {
+        while (n < 50) {
+            let n = n + 1;
+        }
+        return;
+    }
+}
+JACK
+"$dir/compiler" "$dir/loop"
+"$dir/translator" "$dir/loop"
+"$dir/assembler" -g "$dir/loop/loop.asm"
+"$dir/emulator" -p -n 100000 "$dir/loop/loop.hack" >"$dir/profile" 2>&1
+if ! grep -Eq ' 1  Main\.spin$' "$dir/profile" ||
+   grep -q 'Main.spin -> Main.spin' "$dir/profile"; then
+  cat "$dir/profile"
+  echo "FAIL: loop at the entry of Main.spin counted as calls"
+  exit 1
+fi
+echo "PASS"
@@ -17,12 +17,21 @@
 #define MAX_LINE_LENGTH 128
 #define MAX_SYMBOL_LENGTH 32
 #define MAX_CONSTANT 32767
+#define MAX_ROM_ADDRESS 32767U
+#define INITIAL_CAPACITY 16
 #define MAX_FILE_NAME 256
 #define DT_REG 8
 #define DT_UNKNOWN 0
 #define SLASH '/'
+#define FNV_OFFSET 14695981039346656037UL
+#define FNV_PRIME 1099511628211UL
+#define CACHE_DIR ".n2t"
+#define LIBRARY_EXT ".lib"
+#define CLASS_MARKER "// class "
+#define LINE_NOTE "// line "
 
 #define STACK_ADDRESS 256U
+#define UNROLL_LOCALS 8
 
 #define EXIT_ERROR(t)                                                          \
   do {                                                                         \
@@ -31,25 +40,60 @@
   } while (0)
 
 void sys_init(FILE *ofile, char const *fname);
-void parse_file(FILE *file, FILE *ofile, char const *fname,
-                unsigned *commandNumber);
+int parse_file(FILE *file, FILE *ofile, char const *fname,
+               unsigned *commandNumber);
+void translate_cached(FILE *file, FILE *ofile, char const *dir,
+                      char const *fname);
+void link_library(FILE *ofile, char const *lib, char const *dir);
+void write_report(char const *asm_path, FILE *output);
 int write_command(char const *command, char const *arg1, char const *arg2,
                   char *foo_name, char const *fname, size_t const lineNumber,
                   unsigned *commandNumber, FILE *output);
+void write_branch(char const *cmp, bool negate, char const *label,
+                  char const *foo_name, unsigned *commandNumber, FILE *output);
+void write_function(char const *foo_name, int nVars, char const *zero,
+                    unsigned *commandNumber, FILE *output);
+int flush_compare(char *cmp, bool *negate, char *foo_name, char const *fname,
+                  size_t const lineNumber, unsigned *commandNumber,
+                  FILE *output);
 extern char *realpath(const char *restrict path, char *restrict resolved_path);
+bool debugInfo = false; // Pass source lines on to the assembler, -g
 
 // main {{{1
 int main(int argc, char *argv[]) {
-  if (argc < 2) {
-    fprintf(stderr, "Usage: %s <path>\n", argv[0]);
+  bool build = false;     // Write the directory as a library, no bootstrap
+  char const *lib = NULL; // Library linked into the program
+  bool report = false;    // Print the size of every function
+  for (int opt; (opt = getopt(argc, argv, "gLl:r")) != -1;) {
+    switch (opt) {
+    case 'r':
+      report = true;
+      break;
+    case 'g':
+      debugInfo = true;
+      break;
+    case 'L':
+      build = true;
+      break;
+    case 'l':
+      lib = optarg;
+      break;
+    default:
+      optind = argc;
+    }
+  }
+  if (optind != argc - 1) {
+    fprintf(stderr, "Usage: %s [-g] [-r] [-L | -l <library>] <path>\n",
+            argv[0]);
     return EXIT_FAILURE;
   }
 
-  char *path = realpath(argv[1], NULL);
+  char *path = realpath(argv[optind], NULL);
   if (path == NULL) {
     perror("Couldn't resolve path");
     return EXIT_FAILURE;
   }
+  errno = 0;
   char *slash = strrchr(path, SLASH);
   if (slash == NULL) {
     perror("Error allocating memory");
@@ -86,6 +130,8 @@ int main(int argc, char *argv[]) {
         if (ofile) {
           parse_file(file, ofile, fname, commandNumber);
           fclose(ofile);
+          if (report)
+            write_report(path, stdout);
         } else
           fprintf(stderr, "Error creating output file: %s\n", path);
       } else
@@ -103,15 +149,18 @@ int main(int argc, char *argv[]) {
       strncpy(dname, slash + 1, sizeof(dname) - 1);
       char *file_path = calloc(PATH_MAX, sizeof(char));
       if (file_path) {
-        snprintf(file_path, PATH_MAX - 1, "%s%c%s.asm", path, SLASH, dname);
+        snprintf(file_path, PATH_MAX - 1, "%s%c%s%s", path, SLASH, dname,
+                 (build) ? LIBRARY_EXT : ".asm");
         FILE *ofile = fopen(file_path, "w");
-        if (ofile) {
+        if (ofile && !build) {
           sys_init(ofile, dname);
           *commandNumber += 4;
-          char foo_name_init[9];
+          char foo_name_init[] = "Bootstrap";
           write_command("call", "Sys.init", "0", foo_name_init, "", 0,
                         commandNumber, ofile);
           fprintf(ofile, "\n");
+        }
+        if (ofile) {
           while ((entry = readdir(dir))) {
             if (entry->d_type == DT_REG || entry->d_type == DT_UNKNOWN) {
               char *dot = strrchr(entry->d_name, '.');
@@ -122,14 +171,23 @@ int main(int argc, char *argv[]) {
                 if (file) {
                   *dot = '\0';
                   entry->d_name[MAX_SYMBOL_LENGTH - 1] = '\0';
-                  parse_file(file, ofile, entry->d_name, commandNumber);
+                  if (build)
+                    fprintf(ofile, "%s%s\n", CLASS_MARKER, entry->d_name);
+                  translate_cached(file, ofile, path, entry->d_name);
                   fclose(file);
                 } else
                   perror("Error opening file");
               }
             }
           }
+          if (lib)
+            link_library(ofile, lib, path);
           fclose(ofile);
+          if (report) {
+            snprintf(file_path, PATH_MAX - 1, "%s%c%s%s", path, SLASH, dname,
+                     (build) ? LIBRARY_EXT : ".asm");
+            write_report(file_path, stdout);
+          }
         } else
           perror("Error opening out file");
         free(file_path);
@@ -155,12 +213,238 @@ void sys_init(FILE *output, char const *fname) {
   fprintf(output, "\t@SP\n");
   fprintf(output, "\tM=D\n");
 }
+// file_hash {{{1
+uint64_t file_hash(FILE *file) {
+  uint64_t hash = FNV_OFFSET;
+  for (int c; (c = fgetc(file)) != EOF;) {
+    hash ^= (uint64_t)(unsigned char)c;
+    hash *= FNV_PRIME;
+  }
+  rewind(file);
+  return hash;
+}
+// translate_cached {{{1
+void translate_cached(FILE *file, FILE *ofile, char const *dir,
+                      char const *fname) {
+  /* Translates a file of a directory into .n2t/<fname>.asm headed by the
+   * hash of its source and appends that to the output. The cached
+   * translation is reused for as long as the hash matches. Labels only
+   * depend on the file itself, so commands are numbered from 0 per file. */
+  char cache_path[PATH_MAX];
+  char header[MAX_LINE_LENGTH];
+  char expected[MAX_LINE_LENGTH];
+  char line[MAX_LINE_LENGTH];
+  unsigned commandNumber = 0;
+  int saved = errno;
+
+  snprintf(expected, sizeof(expected), "// %s %016llx%s\n", fname,
+           (unsigned long long)file_hash(file), (debugInfo) ? " -g" : "");
+  snprintf(cache_path, sizeof(cache_path), "%s%c%s", dir, SLASH, CACHE_DIR);
+  mkdir(cache_path, 0755);
+  snprintf(cache_path, sizeof(cache_path), "%s%c%s%c%s.asm", dir, SLASH,
+           CACHE_DIR, SLASH, fname);
+
+  FILE *cached = fopen(cache_path, "r");
+  if (cached && fgets(header, sizeof(header), cached) &&
+      !strcmp(header, expected)) {
+    while (fgets(line, sizeof(line), cached))
+      fputs(line, ofile);
+    fclose(cached);
+    errno = saved;
+    return;
+  }
+  if (cached)
+    fclose(cached);
+
+  cached = fopen(cache_path, "w+");
+  errno = saved;
+  if (cached == NULL) {
+    parse_file(file, ofile, fname, &commandNumber);
+    return;
+  }
+  fputs(expected, cached);
+  int failed = parse_file(file, cached, fname, &commandNumber);
+  rewind(cached);
+  fgets(header, sizeof(header), cached);
+  while (fgets(line, sizeof(line), cached))
+    fputs(line, ofile);
+  fclose(cached);
+  if (failed)
+    remove(cache_path);
+}
+// link_library {{{1
+void link_library(FILE *ofile, char const *lib, char const *dir) {
+  /* Appends the classes of a library built with -L, except for those the
+   * program defines itself. Every class is translated with labels and
+   * statics named after it, so its code can go anywhere in the output. */
+  char line[MAX_LINE_LENGTH];
+  char vm_path[PATH_MAX];
+  struct stat vm_stat;
+  bool skip = false;
+  FILE *file = fopen(lib, "r");
+  if (file == NULL) {
+    perror("Error opening library");
+    return;
+  }
+  while (fgets(line, sizeof(line), file)) {
+    if (!strncmp(line, CLASS_MARKER, strlen(CLASS_MARKER))) {
+      char *name = line + strlen(CLASS_MARKER);
+      name[strcspn(name, "\n")] = '\0';
+      snprintf(vm_path, sizeof(vm_path), "%s%c%s.vm", dir, SLASH, name);
+      int saved = errno;
+      skip = stat(vm_path, &vm_stat) == 0;
+      errno = saved;
+      continue;
+    }
+    if (!skip)
+      fputs(line, ofile);
+  }
+  fclose(file);
+}
+// write_report {{{1
+typedef enum {
+  PUSH_,
+  POP_,
+  ARITHMETIC_,
+  COMPARE_,
+  BRANCH_,
+  CALL_,
+  FUNCTION_,
+  RETURN_,
+  OTHER_,
+  class_num
+} CommandClass;
+
+char const *const command_class[class_num] = {
+    [PUSH_] = "push",         [POP_] = "pop",       [ARITHMETIC_] = "arith",
+    [COMPARE_] = "cmp",       [BRANCH_] = "branch", [CALL_] = "call",
+    [FUNCTION_] = "function", [RETURN_] = "return", [OTHER_] = "other"};
+
+typedef struct {
+  char name[MAX_SYMBOL_LENGTH * 2];
+  unsigned words[class_num];
+  unsigned total;
+} FunctionSize;
+
+static CommandClass class_of(char const *command) {
+  if (!strcmp(command, "push"))
+    return PUSH_;
+  if (!strcmp(command, "pop"))
+    return POP_;
+  if (!strcmp(command, "add") || !strcmp(command, "sub") ||
+      !strcmp(command, "neg") || !strcmp(command, "and") ||
+      !strcmp(command, "or") || !strcmp(command, "not"))
+    return ARITHMETIC_;
+  // Comparisons fused with an if-goto are listed under the comparison
+  if (!strcmp(command, "eq") || !strcmp(command, "gt") ||
+      !strcmp(command, "lt"))
+    return COMPARE_;
+  if (!strcmp(command, "label") || !strcmp(command, "goto") ||
+      !strcmp(command, "if-goto"))
+    return BRANCH_;
+  if (!strcmp(command, "call"))
+    return CALL_;
+  if (!strcmp(command, "function"))
+    return FUNCTION_;
+  if (!strcmp(command, "return"))
+    return RETURN_;
+  return OTHER_;
+}
+
+static int by_size(const void *a, const void *b) {
+  const FunctionSize *x = a, *y = b;
+  return (x->total < y->total) - (x->total > y->total);
+}
+
+void write_report(char const *asm_path, FILE *output) {
+  /* Counts the Hack instructions of every function by the class of the VM
+   * command they were translated from, going by the '// [N] command'
+   * comments of the output. Lists the functions from the largest down with
+   * their running share of the ROM, the first ones are what to shrink
+   * when the program no longer fits. */
+  char line[MAX_LINE_LENGTH];
+  char command[MAX_SYMBOL_LENGTH];
+  char arg1[MAX_SYMBOL_LENGTH * 2];
+  FILE *file = fopen(asm_path, "r");
+  FunctionSize *functions = malloc(INITIAL_CAPACITY * sizeof(FunctionSize));
+  size_t n = 0, capacity = INITIAL_CAPACITY;
+  if (file == NULL || functions == NULL) {
+    perror("Error reading output for report");
+    if (file)
+      fclose(file);
+    free(functions);
+    return;
+  }
+  functions[n++] = (FunctionSize){.name = "Bootstrap"};
+  FunctionSize *current = &functions[0];
+  CommandClass class = OTHER_;
+  unsigned total = 0;
+  while (fgets(line, sizeof(line), file)) {
+    char *c = line + strspn(line, " \t");
+    if (sscanf(c, "// [%*u] %31s %63s", command, arg1) >= 1) {
+      class = class_of(command);
+      if (class != FUNCTION_)
+        continue;
+      if (n == capacity) {
+        FunctionSize *grown =
+            realloc(functions, 2 * capacity * sizeof(FunctionSize));
+        if (grown == NULL) {
+          perror("Failed to allocate memory!");
+          break;
+        }
+        functions = grown;
+        capacity *= 2;
+      }
+      current = &functions[n++];
+      *current = (FunctionSize){0};
+      snprintf(current->name, sizeof(current->name), "%s", arg1);
+    } else if (*c && *c != '/' && *c != '(' && !isspace(*c)) {
+      current->words[class]++;
+      current->total++;
+      total++;
+    }
+  }
+  fclose(file);
+  qsort(functions, n, sizeof(FunctionSize), by_size);
+
+  unsigned sums[class_num] = {0};
+  unsigned running = 0;
+  fprintf(output, "%7s %7s %7s", "words", "rom%", "cum%");
+  for (int k = 0; k < class_num; k++)
+    fprintf(output, " %8s", command_class[k]);
+  fprintf(output, "  name\n");
+  for (size_t i = 0; i < n; i++) {
+    FunctionSize *f = &functions[i];
+    running += f->total;
+    fprintf(output, "%7u %6.2f%% %6.2f%%", f->total,
+            100.0 * f->total / (MAX_ROM_ADDRESS + 1),
+            100.0 * running / (MAX_ROM_ADDRESS + 1));
+    for (int k = 0; k < class_num; k++) {
+      fprintf(output, " %8u", f->words[k]);
+      sums[k] += f->words[k];
+    }
+    fprintf(output, "  %s\n", f->name);
+  }
+  fprintf(output, "%7u %6.2f%% %7s", total,
+          100.0 * total / (MAX_ROM_ADDRESS + 1), "");
+  for (int k = 0; k < class_num; k++)
+    fprintf(output, " %8u", sums[k]);
+  fprintf(output, "  total of %zu functions\n", n);
+  if (total > MAX_ROM_ADDRESS + 1)
+    fprintf(output, "The program exceeds the ROM by %u words\n",
+            total - (MAX_ROM_ADDRESS + 1));
+  free(functions);
+}
 // parse_file {{{1
-void parse_file(FILE *file, FILE *ofile, char const *fname,
-                unsigned *commandNumber) {
+int parse_file(FILE *file, FILE *ofile, char const *fname,
+               unsigned *commandNumber) {
   fprintf(ofile, "// %s\n", fname);
   char line[MAX_LINE_LENGTH];
-  char foo_name[MAX_SYMBOL_LENGTH];
+  char foo_name[MAX_SYMBOL_LENGTH] = {0};
+  char cmp[MAX_SYMBOL_LENGTH] = {0}; // Comparison waiting for an if-goto
+  bool negate = false;
+  size_t cmpLine = 0;
+  int failed = EXIT_SUCCESS;
   for (size_t lineNumber = 1; fgets(line, sizeof(line), file); lineNumber++) {
     char command[MAX_SYMBOL_LENGTH] = {0};
     char arg1[MAX_SYMBOL_LENGTH * 2] = "";
@@ -168,6 +452,20 @@ void parse_file(FILE *file, FILE *ofile, char const *fname,
     char *c = line;
     char token[sizeof(arg1)] = "";
 
+    /* The compiler notes the Jack line of every statement with -g, the
+     * assembler maps the next instruction to it. A comparison still held
+     * back for an if-goto belongs to the line before. */
+    if (debugInfo && !strncmp(line, LINE_NOTE, strlen(LINE_NOTE))) {
+      if (*cmp && flush_compare(cmp, &negate, foo_name, fname, cmpLine,
+                                commandNumber, ofile)) {
+        failed = EXIT_FAILURE;
+        break;
+      }
+      fprintf(ofile, "//@ %s.jack:%ld %s\n", fname,
+              strtol(line + strlen(LINE_NOTE), NULL, 10), foo_name);
+      continue;
+    }
+
     for (size_t i = 0; i < MAX_SYMBOL_LENGTH * 2; c++) {
       if (isspace(*c) || *c == '/' || *c == '\0' ||
           i == MAX_SYMBOL_LENGTH * 2 - 1) {
@@ -195,13 +493,174 @@ void parse_file(FILE *file, FILE *ofile, char const *fname,
     }
 
     if (*command) {
+      char *zero = strstr(line, "// zero");
+      if (zero && !strcmp(command, "function")) {
+        // The compiler lists the locals that may be read before assignment
+        if (*cmp && flush_compare(cmp, &negate, foo_name, fname, cmpLine,
+                                  commandNumber, ofile)) {
+          failed = EXIT_FAILURE;
+          break;
+        }
+        if (debugInfo)
+          fprintf(ofile, "//@ %s.vm:%zu %s\n", fname, lineNumber, arg1);
+        fprintf(ofile, "// [%d] %s %s %s\n", *commandNumber, command, arg1,
+                arg2);
+        strcpy(foo_name, arg1);
+        write_function(foo_name, atoi(arg2), zero + strlen("// zero"),
+                       commandNumber, ofile);
+        continue;
+      }
+      if (*cmp) {
+        if (!strcmp(command, "not") && !negate) {
+          negate = true;
+          continue;
+        }
+        if (!strcmp(command, "if-goto")) {
+          fprintf(ofile, "// [%d] %s%s if-goto %s\n", *commandNumber, cmp,
+                  (negate) ? " not" : "", arg1);
+          write_branch(cmp, negate, arg1, foo_name, commandNumber, ofile);
+          *cmp = '\0';
+          negate = false;
+          continue;
+        }
+        if (flush_compare(cmp, &negate, foo_name, fname, cmpLine,
+                          commandNumber, ofile)) {
+          failed = EXIT_FAILURE;
+          break;
+        }
+      }
+      if (!strcmp(command, "eq") || !strcmp(command, "gt") ||
+          !strcmp(command, "lt")) {
+        strcpy(cmp, command);
+        cmpLine = lineNumber;
+        continue;
+      }
+      if (debugInfo && !strcmp(command, "function"))
+        fprintf(ofile, "//@ %s.vm:%zu %s\n", fname, lineNumber, arg1);
       fprintf(ofile, "// [%d] %s %s %s\n", *commandNumber, command, arg1, arg2);
       if (write_command(command, arg1, arg2, foo_name, fname, lineNumber,
-                        commandNumber, ofile))
+                        commandNumber, ofile)) {
+        failed = EXIT_FAILURE;
         break;
+      }
     }
   }
+  if (*cmp)
+    failed |= flush_compare(cmp, &negate, foo_name, fname, cmpLine,
+                            commandNumber, ofile);
   fprintf(ofile, "\n");
+  return failed;
+}
+// write_function {{{1
+void write_function(char const *foo_name, int nVars, char const *zero,
+                    unsigned *commandNumber, FILE *output) {
+  /* Function entry, zero is a list of the locals to clear or NULL for all of
+   * them. Small frames are cleared with straight-line code walking A over
+   * the new frame, large ones that have to be cleared entirely in a loop. */
+  fprintf(output, "(%s)\n", foo_name);
+  if (nVars <= 0)
+    return;
+  if (zero == NULL && nVars > UNROLL_LOCALS) {
+    *commandNumber += 9;
+    fprintf(output, "\t@%d\n", nVars);
+    fprintf(output, "\tD=A\n");
+    fprintf(output, "(%s$__init__)\n", foo_name);
+    fprintf(output, "\t@SP\n");
+    fprintf(output, "\tM=M+1\n");
+    fprintf(output, "\tA=M-1\n");
+    fprintf(output, "\tM=0\n");
+    fprintf(output, "\tD=D-1\n");
+    fprintf(output, "\t@%s$__init__\n", foo_name);
+    fprintf(output, "\tD;JGT\n");
+    return;
+  }
+  int cur = -1; // A points to local cur
+  for (int k = 0; k < nVars; k++) {
+    if (zero) {
+      char *end;
+      k = strtol(zero, &end, 10);
+      if (end == zero || k < cur || k >= nVars)
+        break;
+      zero = end;
+    }
+    if (cur < 0) {
+      *commandNumber += 2;
+      fprintf(output, "\t@SP\n");
+      fprintf(output, "\tA=M\n");
+      cur = 0;
+    }
+    if (k - cur > 3) {
+      *commandNumber += 3;
+      fprintf(output, "\tD=A\n");
+      fprintf(output, "\t@%d\n", k - cur);
+      fprintf(output, "\tA=D+A\n");
+    } else {
+      for (; cur < k; cur++) {
+        *commandNumber += 1;
+        fprintf(output, "\tA=A+1\n");
+      }
+    }
+    cur = k;
+    *commandNumber += 1;
+    fprintf(output, "\tM=0\n");
+  }
+  if (cur == nVars - 1) {
+    *commandNumber += 3;
+    fprintf(output, "\tD=A+1\n");
+    fprintf(output, "\t@SP\n");
+    fprintf(output, "\tM=D\n");
+  } else if (nVars <= 2) {
+    *commandNumber += 1 + nVars;
+    fprintf(output, "\t@SP\n");
+    for (int k = 0; k < nVars; k++)
+      fprintf(output, "\tM=M+1\n");
+  } else {
+    *commandNumber += 4;
+    fprintf(output, "\t@%d\n", nVars);
+    fprintf(output, "\tD=A\n");
+    fprintf(output, "\t@SP\n");
+    fprintf(output, "\tM=D+M\n");
+  }
+}
+// flush_compare {{{1
+int flush_compare(char *cmp, bool *negate, char *foo_name, char const *fname,
+                  size_t const lineNumber, unsigned *commandNumber,
+                  FILE *output) {
+  // Writes out a deferred comparison that wasn't followed by an if-goto
+  fprintf(output, "// [%d] %s  \n", *commandNumber, cmp);
+  if (write_command(cmp, "", "", foo_name, fname, lineNumber, commandNumber,
+                    output))
+    return EXIT_FAILURE;
+  if (*negate) {
+    fprintf(output, "// [%d] not  \n", *commandNumber);
+    write_command("not", "", "", foo_name, fname, lineNumber, commandNumber,
+                  output);
+  }
+  *cmp = '\0';
+  *negate = false;
+  return EXIT_SUCCESS;
+}
+// write_branch {{{1
+void write_branch(char const *cmp, bool negate, char const *label,
+                  char const *foo_name, unsigned *commandNumber, FILE *output) {
+  // Comparison followed by (not) if-goto, jumps on the flags of x - y
+  char const *jump;
+  if (!strcmp(cmp, "eq")) {
+    jump = (negate) ? "JNE" : "JEQ";
+  } else if (!strcmp(cmp, "gt")) {
+    jump = (negate) ? "JLE" : "JGT";
+  } else {
+    jump = (negate) ? "JGE" : "JLT";
+  }
+  *commandNumber += 8;
+  fprintf(output, "\t@SP\n");
+  fprintf(output, "\tAM=M-1\n");
+  fprintf(output, "\tD=M\n");
+  fprintf(output, "\t@SP\n");
+  fprintf(output, "\tAM=M-1\n");
+  fprintf(output, "\tD=M-D\n");
+  fprintf(output, "\t@%s$%s\n", foo_name, label);
+  fprintf(output, "\tD;%s\n", jump);
 }
 // write_command {{{1
 int write_command(char const *command, char const *arg1, char const *arg2,
@@ -443,7 +902,6 @@ int write_command(char const *command, char const *arg1, char const *arg2,
     fprintf(output, "\tD;JNE\n");
     // call {{{2
   } else if (!strcmp(command, "call")) {
-    strcpy(foo_name, arg1);
     *commandNumber += 41;
     fprintf(output, "\t@%s$__return_%u__\n", foo_name, *commandNumber);
     fprintf(output, "\tD=A\n");
@@ -484,27 +942,13 @@ int write_command(char const *command, char const *arg1, char const *arg2,
     fprintf(output, "\tD=M\n");
     fprintf(output, "\t@LCL\n");
     fprintf(output, "\tM=D\n");
-    fprintf(output, "\t@%s\n", foo_name);
+    fprintf(output, "\t@%s\n", arg1);
     fprintf(output, "\t0;JMP\n");
     fprintf(output, "(%s$__return_%u__)\n", foo_name, *commandNumber);
     // function {{{2
   } else if (!strcmp(command, "function")) {
     strcpy(foo_name, arg1);
-    *commandNumber += 11;
-    fprintf(output, "(%s)\n", foo_name);
-    fprintf(output, "\t@%s\n", arg2);
-    fprintf(output, "\tD=A\n");
-    fprintf(output, "\t@%s$__endinit__\n", foo_name);
-    fprintf(output, "\tD;JEQ\n");
-    fprintf(output, "(%s$__init__)\n", foo_name);
-    fprintf(output, "\t@SP\n");
-    fprintf(output, "\tM=M+1\n");
-    fprintf(output, "\tA=M-1\n");
-    fprintf(output, "\tM=0\n");
-    fprintf(output, "\tD=D-1\n");
-    fprintf(output, "\t@%s$__init__\n", foo_name);
-    fprintf(output, "\tD;JGT\n");
-    fprintf(output, "(%s$__endinit__)\n", foo_name);
+    write_function(foo_name, c, NULL, commandNumber, output);
     // return {{{2
   } else if (!strcmp(command, "return")) {
     *commandNumber += 41;